@@ -0,0 +1,578 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <limits.h>
+
+#ifdef USE_SAS_NAMESPACE
+namespace sas {
+#endif
+
+/**
+ * @brief The ConcurrentSparseAddressSpace class
+ * Sparse address space which may be accessed from multiple threads at once. Memory is kept in fixed-size pages of
+ * 2^PageBits bytes, held in a radix table like PageTableStorage. Tables and pages are installed with a single
+ * compare-and-swap and are never moved or removed while the address space is shared, such that:
+ * - Reads take no locks and never modify the address space. Reads of unmapped addresses return 0, without allocating
+ *   pages.
+ * - Writes to existing pages take no locks. Writes to unmapped addresses race to install the missing page; the losing
+ *   threads discard their allocation and use the winning page.
+ * Each thread caches recent page lookups in a thread-local lookup cache, which is shared by all concurrent address
+ * spaces used by the thread.
+ *
+ * Atomic operations and load-reserved/store-conditional are provided for naturally aligned values. As aligned values
+ * never straddle a page, these map directly onto host atomics on the bytes of the page.
+ *
+ * The address space only synchronizes its own structure. Plain reads and writes access the bytes of a page with relaxed
+ * atomic loads and stores, such that they do not race with atomic operations on the same bytes, but concurrent
+ * accesses to the same bytes are unordered with respect to each other, as they would be for the simulated harts.
+ * clear() and destruction require exclusive access.
+ *
+ * The interface only covers accesses from harts. Unlike SparseAddressSpace, there is no initialization SAS, reset(),
+ * snapshots or segments(), so the class is not a substitute for SparseAddressSpace in code using those.
+ */
+template <typename T_addr, unsigned PageBits = 12, unsigned LevelBits = 10>
+class ConcurrentSparseAddressSpace {
+public:
+    static_assert(std::is_unsigned<T_addr>::value, "Address type must be an unsigned integer type.");
+    static_assert(sizeof(T_addr) * CHAR_BIT > PageBits, "Pages must be smaller than the address space.");
+    static_assert(LevelBits > 0, "LevelBits must be positive.");
+
+    constexpr static T_addr c_maxAddr = std::numeric_limits<T_addr>::max();
+    constexpr static bool c_hostLittleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+    constexpr static size_t c_pageSize = size_t(1) << PageBits;
+    constexpr static unsigned c_pageNumberBits = sizeof(T_addr) * CHAR_BIT - PageBits;
+    constexpr static unsigned c_levels = (c_pageNumberBits + LevelBits - 1) / LevelBits;
+    constexpr static unsigned c_topLevelBits = c_pageNumberBits - (c_levels - 1) * LevelBits;
+
+    /**
+     * @param harts: number of harts which may hold a reservation, see loadReserved.
+     */
+    explicit ConcurrentSparseAddressSpace(unsigned harts = 64)
+        : m_root(allocateTable(0)), m_id(nextId()), m_reservations(new Reservation[harts]), m_harts(harts) {}
+    ~ConcurrentSparseAddressSpace() { freeTable(m_root, 0); }
+    ConcurrentSparseAddressSpace(const ConcurrentSparseAddressSpace&) = delete;
+    ConcurrentSparseAddressSpace& operator=(const ConcurrentSparseAddressSpace&) = delete;
+
+    uint8_t readByte(T_addr address) const {
+        const uint8_t* page = findPage(address >> PageBits);
+        return page ? __atomic_load_n(page + (address & (c_pageSize - 1)), __ATOMIC_RELAXED) : 0;
+    }
+
+    template <typename T_v>
+    T_v readValue(T_addr address) const {
+        T_v value = 0;
+
+        // Fast path: a single load if the value lies within a single page
+        const size_t offset = address & (c_pageSize - 1);
+        if (c_hostLittleEndian && c_pageSize - offset >= sizeof(T_v)) {
+            if (const uint8_t* page = findPage(address >> PageBits)) {
+                loadRelaxed(reinterpret_cast<uint8_t*>(&value), page + offset, sizeof(T_v));
+            }
+            return value;
+        }
+
+        // The value straddles a page boundary
+        for (unsigned i = 0; i < sizeof(T_v); i++)
+            value |= static_cast<T_v>(readByte(address++)) << (i * CHAR_BIT);
+
+        return value;
+    }
+
+    /**
+     * @brief readBytes
+     * Reads @p n bytes starting at @p address into @p dst, with a single copy per page. Unmapped bytes read as 0.
+     */
+    void readBytes(T_addr address, uint8_t* dst, size_t n) const {
+        checkSpan(address, n);
+        while (n > 0) {
+            const size_t offset = address & (c_pageSize - 1);
+            const size_t chunk = std::min(n, c_pageSize - offset);
+            if (const uint8_t* page = findPage(address >> PageBits)) {
+                loadRelaxed(dst, page + offset, chunk);
+            } else {
+                std::memset(dst, 0, chunk);
+            }
+            dst += chunk;
+            address += chunk;
+            n -= chunk;
+        }
+    }
+
+    void writeByte(T_addr address, uint8_t value) {
+        __atomic_store_n(getOrCreatePage(address >> PageBits) + (address & (c_pageSize - 1)), value, __ATOMIC_RELAXED);
+        invalidateReservations(address, 1);
+    }
+
+    template <typename T_v>
+    void writeValue(T_addr address, T_v value, size_t nbytes) {
+        if (nbytes > sizeof(value)) {
+            throw std::runtime_error("Trying to write more bytes than what is contained in @p value");
+        }
+
+        // Fast path: a single store if the value fits within a single page
+        const size_t offset = address & (c_pageSize - 1);
+        if (c_hostLittleEndian && c_pageSize - offset >= nbytes) {
+            uint8_t* page = getOrCreatePage(address >> PageBits);
+            storeRelaxed(page + offset, reinterpret_cast<const uint8_t*>(&value), nbytes);
+            invalidateReservations(address, nbytes);
+            return;
+        }
+
+        // The value straddles a page boundary
+        for (unsigned i = 0; i < nbytes; i++) {
+            writeByte(address++, value);
+            value >>= CHAR_BIT;
+        }
+    }
+
+    template <typename T_v>
+    void writeValue(T_addr address, T_v value) {
+        writeValue(address, value, sizeof(T_v));
+    }
+
+    /**
+     * @brief writeBytes
+     * Writes @p n bytes from @p src starting at @p address, with a single copy per page.
+     */
+    void writeBytes(T_addr address, const uint8_t* src, size_t n) {
+        checkSpan(address, n);
+        if (n > 0) {
+            invalidateReservations(address, n);
+        }
+        while (n > 0) {
+            const size_t offset = address & (c_pageSize - 1);
+            const size_t chunk = std::min(n, c_pageSize - offset);
+            storeRelaxed(getOrCreatePage(address >> PageBits) + offset, src, chunk);
+            src += chunk;
+            address += chunk;
+            n -= chunk;
+        }
+    }
+
+    void insertSegment(T_addr startaddr, const std::vector<uint8_t>& data) {
+        writeBytes(startaddr, data.data(), data.size());
+    }
+
+    /**
+     * @brief atomicFetchAdd
+     * Atomically adds @p value to the naturally aligned value at @p address.
+     * @returns the previous value.
+     */
+    template <typename T_v>
+    T_v atomicFetchAdd(T_addr address, T_v value) {
+        const T_v old = __atomic_fetch_add(atomicPtr<T_v>(address), value, __ATOMIC_SEQ_CST);
+        invalidateReservations(address, sizeof(T_v));
+        return old;
+    }
+
+    /**
+     * @brief atomicSwap
+     * Atomically replaces the naturally aligned value at @p address with @p value.
+     * @returns the previous value.
+     */
+    template <typename T_v>
+    T_v atomicSwap(T_addr address, T_v value) {
+        const T_v old = __atomic_exchange_n(atomicPtr<T_v>(address), value, __ATOMIC_SEQ_CST);
+        invalidateReservations(address, sizeof(T_v));
+        return old;
+    }
+
+    /**
+     * @brief compareExchange
+     * Atomically replaces the naturally aligned value at @p address with @p desired, if it equals @p expected.
+     * Otherwise, @p expected is updated to the current value.
+     * @returns whether the value was replaced.
+     */
+    template <typename T_v>
+    bool compareExchange(T_addr address, T_v& expected, T_v desired) {
+        const bool exchanged = __atomic_compare_exchange_n(atomicPtr<T_v>(address), &expected, desired, false,
+                                                           __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        if (exchanged) {
+            invalidateReservations(address, sizeof(T_v));
+        }
+        return exchanged;
+    }
+
+    /**
+     * @brief loadReserved
+     * Atomically loads the naturally aligned value at @p address, and places a reservation for @p hart on the
+     * reservation granule containing @p address. Any previous reservation of @p hart is released.
+     */
+    template <typename T_v>
+    T_v loadReserved(T_addr address, unsigned hart) {
+        Reservation& r = reservation(hart);
+        const T_v* ptr = atomicPtr<T_v>(address);
+
+        // The count is raised before the reservation is visible, such that writers never skip a valid reservation
+        m_activeReservations.fetch_add(1, std::memory_order_seq_cst);
+        if (r.granule.exchange(granule(address), std::memory_order_seq_cst) != 0) {
+            m_activeReservations.fetch_sub(1, std::memory_order_relaxed);
+        }
+        const T_v value = __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+        std::memcpy(&r.value, &value, sizeof(T_v));
+        return value;
+    }
+
+    /**
+     * @brief storeConditional
+     * Stores @p value at @p address if @p hart holds a reservation on the granule containing @p address, which has not
+     * been invalidated by a write to the granule since loadReserved. The reservation of @p hart is released either way.
+     * The store is a compare-and-swap against the value returned by loadReserved, such that conflicting writes which
+     * race with the store conditional itself also cause it to fail, unless they wrote the reserved value.
+     * @returns whether the store was performed.
+     */
+    template <typename T_v>
+    bool storeConditional(T_addr address, T_v value, unsigned hart) {
+        Reservation& r = reservation(hart);
+        T_v* ptr = atomicPtr<T_v>(address);
+        if (r.granule.exchange(0, std::memory_order_seq_cst) != granule(address)) {
+            // An invalidated reservation has already been accounted for by the invalidating writer
+            return false;
+        }
+        m_activeReservations.fetch_sub(1, std::memory_order_relaxed);
+
+        T_v expected;
+        std::memcpy(&expected, &r.value, sizeof(T_v));
+        if (!__atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return false;
+        }
+        invalidateReservations(address, sizeof(T_v));
+        return true;
+    }
+
+    /**
+     * @brief pageCount
+     * @returns the number of allocated pages.
+     */
+    size_t pageCount() const { return m_pageCount.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief clear
+     * Removes all pages and reservations. Must not be called concurrently with any other access to the address space.
+     * Any lookups cached by other threads are invalidated, as the address space is given a new identity.
+     */
+    void clear() {
+        freeTable(m_root, 0);
+        m_root = allocateTable(0);
+        m_pageCount.store(0, std::memory_order_relaxed);
+        m_id = nextId();
+        for (unsigned hart = 0; hart < m_harts; hart++) {
+            m_reservations[hart].granule.store(0, std::memory_order_relaxed);
+        }
+        m_activeReservations.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    /**
+     * @brief The Slot type
+     * An entry of a table, pointing to either a subtable (a Slot array) or, at the last level, a page.
+     */
+    using Slot = std::atomic<void*>;
+
+    /**
+     * @brief The TLB struct
+     * Per-thread direct-mapped page lookup cache. Entries are tagged with the identity of the address space which
+     * they were looked up in, such that a single cache may serve all address spaces used by a thread.
+     */
+    struct TLB {
+        struct Entry {
+            uint64_t owner = 0;
+            uint64_t pn = 0;
+            uint8_t* page = nullptr;
+        };
+        constexpr static size_t c_entries = 16;
+        Entry entries[c_entries];
+    };
+
+    static TLB& tlb() {
+        thread_local TLB t_tlb;
+        return t_tlb;
+    }
+
+    static size_t tlbIndex(uint64_t pn) {
+        return static_cast<size_t>((pn * 0x9E3779B97F4A7C15ull) >> 40) & (TLB::c_entries - 1);
+    }
+
+    /**
+     * @brief nextId
+     * @returns a process-wide unique identity for tagging lookup cache entries. Identities are never reused, such that
+     * entries of a destroyed or cleared address space can never match.
+     */
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> s_nextId{1};
+        return s_nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static constexpr size_t fanout(unsigned level) {
+        return size_t(1) << (level == 0 ? c_topLevelBits : LevelBits);
+    }
+    static constexpr unsigned shift(unsigned level) { return (c_levels - 1 - level) * LevelBits; }
+    static constexpr size_t index(uint64_t pn, unsigned level) { return (pn >> shift(level)) & (fanout(level) - 1); }
+
+    static Slot* allocateTable(unsigned level) {
+        Slot* table = new Slot[fanout(level)];
+        for (size_t i = 0; i < fanout(level); i++) {
+            table[i].store(nullptr, std::memory_order_relaxed);
+        }
+        return table;
+    }
+
+    static void freeTable(Slot* table, unsigned level) {
+        for (size_t i = 0; i < fanout(level); i++) {
+            void* entry = table[i].load(std::memory_order_relaxed);
+            if (!entry) {
+                continue;
+            }
+            if (level + 1 == c_levels) {
+                delete[] static_cast<uint8_t*>(entry);
+            } else {
+                freeTable(static_cast<Slot*>(entry), level + 1);
+            }
+        }
+        delete[] table;
+    }
+
+    /**
+     * @brief findPage
+     * @returns the bytes of page @p pn, or nullptr if the page is not allocated. Lock-free; the acquire loads pair with
+     * the release of the compare-and-swap which installed each table and page.
+     */
+    uint8_t* findPage(uint64_t pn) const {
+        typename TLB::Entry& entry = tlb().entries[tlbIndex(pn)];
+        if (entry.owner == m_id && entry.pn == pn) {
+            return entry.page;
+        }
+
+        const Slot* table = m_root;
+        for (unsigned level = 0; level + 1 < c_levels; level++) {
+            table = static_cast<const Slot*>(table[index(pn, level)].load(std::memory_order_acquire));
+            if (!table) {
+                return nullptr;
+            }
+        }
+        auto* page = static_cast<uint8_t*>(table[index(pn, c_levels - 1)].load(std::memory_order_acquire));
+        if (page) {
+            // Only allocated pages are cached, as unallocated pages may be installed by other threads at any time
+            entry = {m_id, pn, page};
+        }
+        return page;
+    }
+
+    /**
+     * @brief getOrCreatePage
+     * @returns the bytes of page @p pn, installing any missing tables and the page itself.
+     */
+    uint8_t* getOrCreatePage(uint64_t pn) {
+        if (uint8_t* page = findPage(pn)) {
+            return page;
+        }
+
+        Slot* table = m_root;
+        for (unsigned level = 0; level + 1 < c_levels; level++) {
+            table = static_cast<Slot*>(install(table[index(pn, level)], [&] { return allocateTable(level + 1); },
+                                               [&](void* p) { delete[] static_cast<Slot*>(p); }));
+        }
+        auto* page = static_cast<uint8_t*>(install(
+            table[index(pn, c_levels - 1)],
+            [&] {
+                m_pageCount.fetch_add(1, std::memory_order_relaxed);
+                return new uint8_t[c_pageSize]();
+            },
+            [&](void* p) {
+                m_pageCount.fetch_sub(1, std::memory_order_relaxed);
+                delete[] static_cast<uint8_t*>(p);
+            }));
+        tlb().entries[tlbIndex(pn)] = {m_id, pn, page};
+        return page;
+    }
+
+    /**
+     * @brief install
+     * @returns the entry of @p slot, installing an entry created by @p create if the slot is empty. If another thread
+     * installs an entry first, the created entry is released through @p discard.
+     */
+    template <typename F_create, typename F_discard>
+    static void* install(Slot& slot, F_create create, F_discard discard) {
+        void* entry = slot.load(std::memory_order_acquire);
+        if (entry) {
+            return entry;
+        }
+        void* created = create();
+        if (slot.compare_exchange_strong(entry, created, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return created;
+        }
+        discard(created);
+        return entry;
+    }
+
+    /**
+     * @brief loadRelaxed, storeRelaxed
+     * Copy @p n bytes from or to a page with relaxed atomic loads and stores, which compile to plain moves. The bytes
+     * are copied in naturally aligned 8-byte words where possible, such that a naturally aligned value is copied with
+     * a single access.
+     */
+    static void loadRelaxed(uint8_t* dst, const uint8_t* src, size_t n) {
+        if (n == sizeof(uint64_t) || n == sizeof(uint32_t) || n == sizeof(uint16_t)) {
+            if ((reinterpret_cast<uintptr_t>(src) & (n - 1)) == 0) {
+                loadWord(dst, src, n);
+                return;
+            }
+        }
+        for (; n > 0 && (reinterpret_cast<uintptr_t>(src) & 7) != 0; n--) {
+            *dst++ = __atomic_load_n(src++, __ATOMIC_RELAXED);
+        }
+        for (; n >= 8; n -= 8, src += 8, dst += 8) {
+            loadWord(dst, src, 8);
+        }
+        for (; n > 0; n--) {
+            *dst++ = __atomic_load_n(src++, __ATOMIC_RELAXED);
+        }
+    }
+    static void storeRelaxed(uint8_t* dst, const uint8_t* src, size_t n) {
+        if (n == sizeof(uint64_t) || n == sizeof(uint32_t) || n == sizeof(uint16_t)) {
+            if ((reinterpret_cast<uintptr_t>(dst) & (n - 1)) == 0) {
+                storeWord(dst, src, n);
+                return;
+            }
+        }
+        for (; n > 0 && (reinterpret_cast<uintptr_t>(dst) & 7) != 0; n--) {
+            __atomic_store_n(dst++, *src++, __ATOMIC_RELAXED);
+        }
+        for (; n >= 8; n -= 8, src += 8, dst += 8) {
+            storeWord(dst, src, 8);
+        }
+        for (; n > 0; n--) {
+            __atomic_store_n(dst++, *src++, __ATOMIC_RELAXED);
+        }
+    }
+
+    /**
+     * @brief loadWord, storeWord
+     * Copy a naturally aligned word of @p n (2, 4 or 8) bytes from or to a page with a single relaxed atomic access.
+     */
+    static void loadWord(uint8_t* dst, const uint8_t* src, size_t n) {
+        if (n == 8) {
+            const uint64_t word = __atomic_load_n(reinterpret_cast<const uint64_t*>(src), __ATOMIC_RELAXED);
+            std::memcpy(dst, &word, 8);
+        } else if (n == 4) {
+            const uint32_t word = __atomic_load_n(reinterpret_cast<const uint32_t*>(src), __ATOMIC_RELAXED);
+            std::memcpy(dst, &word, 4);
+        } else {
+            const uint16_t word = __atomic_load_n(reinterpret_cast<const uint16_t*>(src), __ATOMIC_RELAXED);
+            std::memcpy(dst, &word, 2);
+        }
+    }
+    static void storeWord(uint8_t* dst, const uint8_t* src, size_t n) {
+        if (n == 8) {
+            uint64_t word;
+            std::memcpy(&word, src, 8);
+            __atomic_store_n(reinterpret_cast<uint64_t*>(dst), word, __ATOMIC_RELAXED);
+        } else if (n == 4) {
+            uint32_t word;
+            std::memcpy(&word, src, 4);
+            __atomic_store_n(reinterpret_cast<uint32_t*>(dst), word, __ATOMIC_RELAXED);
+        } else {
+            uint16_t word;
+            std::memcpy(&word, src, 2);
+            __atomic_store_n(reinterpret_cast<uint16_t*>(dst), word, __ATOMIC_RELAXED);
+        }
+    }
+
+    /**
+     * @brief checkSpan
+     * Throws if the span of @p n bytes starting at @p address exceeds the address space.
+     */
+    static void checkSpan(T_addr address, size_t n) {
+        if (n > 0 && static_cast<uint64_t>(n - 1) > static_cast<uint64_t>(c_maxAddr - address)) {
+            throw std::runtime_error("Trying to access bytes beyond the end of the address space");
+        }
+    }
+
+    /**
+     * @brief The Reservation struct
+     * Reservation of a hart, see loadReserved. granule is 0 if the hart holds no reservation. value is only accessed
+     * by the hart itself.
+     */
+    struct alignas(64) Reservation {
+        std::atomic<uint64_t> granule{0};
+        uint64_t value = 0;
+    };
+
+    /**
+     * @brief c_granuleBits
+     * log2 of the size of reservation granules, in bytes.
+     */
+    constexpr static unsigned c_granuleBits = 6;
+
+    static uint64_t granule(T_addr address) { return (static_cast<uint64_t>(address) >> c_granuleBits) + 1; }
+
+    Reservation& reservation(unsigned hart) {
+        if (hart >= m_harts) {
+            throw std::runtime_error("Hart index exceeds the number of harts of the address space");
+        }
+        return m_reservations[hart];
+    }
+
+    /**
+     * @brief atomicPtr
+     * @returns a pointer to the naturally aligned value at @p address, allocating its page if necessary.
+     */
+    template <typename T_v>
+    T_v* atomicPtr(T_addr address) {
+        static_assert(std::is_integral<T_v>::value && (sizeof(T_v) == 1 || sizeof(T_v) == 2 || sizeof(T_v) == 4 ||
+                                                       sizeof(T_v) == 8),
+                      "Atomic operations are supported on 1, 2, 4 and 8-byte integers.");
+        static_assert(c_hostLittleEndian, "Atomic operations require a little-endian host.");
+        if (address & (sizeof(T_v) - 1)) {
+            throw std::runtime_error("Atomic access to a misaligned address");
+        }
+        return reinterpret_cast<T_v*>(getOrCreatePage(address >> PageBits) + (address & (c_pageSize - 1)));
+    }
+
+    /**
+     * @brief invalidateReservations
+     * Invalidates the reservations of all harts on granules overlapping the @p n bytes written at @p address. Writes
+     * only pay for a single load while no reservations are held.
+     */
+    void invalidateReservations(T_addr address, size_t n) {
+        if (m_activeReservations.load(std::memory_order_seq_cst) == 0) {
+            return;
+        }
+        const uint64_t first = granule(address);
+        const uint64_t last = granule(static_cast<T_addr>(address + (n - 1)));
+        for (unsigned hart = 0; hart < m_harts; hart++) {
+            uint64_t g = m_reservations[hart].granule.load(std::memory_order_relaxed);
+            if (g >= first && g <= last &&
+                m_reservations[hart].granule.compare_exchange_strong(g, 0, std::memory_order_seq_cst)) {
+                m_activeReservations.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Slot* m_root;
+    std::atomic<size_t> m_pageCount{0};
+
+    /**
+     * @brief m_id
+     * Identity of the address space in the per-thread lookup caches. Renewed by clear().
+     */
+    uint64_t m_id;
+
+    std::unique_ptr<Reservation[]> m_reservations;
+    const unsigned m_harts;
+    std::atomic<size_t> m_activeReservations{0};
+};
+
+#ifdef USE_SAS_NAMESPACE
+}
+#endif
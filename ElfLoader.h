@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "SparseAddressSpace.h"
+
+#ifdef USE_SAS_NAMESPACE
+namespace sas {
+#endif
+
+/**
+ * @brief The ElfLoader class
+ * Loads the PT_LOAD segments of ELF32 and ELF64 executables of either byte order into an address space, typically
+ * the initialization SAS:
+ *   ElfLoader::load(sas.getInitSas(), "firmware.elf");
+ * The file is mapped privately into memory, and segments are adopted directly from the mapping without copying their
+ * bytes. Only segments with a zero-filled part (.bss, p_memsz > p_filesz) are copied into a buffer of their own.
+ * Pages of the mapping are thus only read from the file once accessed. Adopted segments are split from the mapping
+ * into views of their own, so a write to a segment lands in the private mapping in place, and the operating system
+ * copies only the written page. Segments whose bytes overlap in the file share the mapping instead, so the first write
+ * to such a segment copies all of its bytes to the heap, as does the first write to a segment shared with the
+ * initialization SAS by reset(). All segments are inserted at once, such that the segment index is only built once.
+ */
+class ElfLoader {
+public:
+    /**
+     * @brief The Image struct
+     * Properties of a loaded executable.
+     */
+    struct Image {
+        uint64_t entry = 0;
+        unsigned elfClass = 0;  // 32 or 64
+        uint16_t machine = 0;
+        size_t segments = 0;
+    };
+
+    /**
+     * @brief load
+     * Loads the executable at @p path into @p sas. Segments are placed at their virtual addresses, or at their
+     * physical addresses if @p physical is set. Throws if the file is not a valid ELF executable, or if any segment
+     * lies beyond the address space of @p sas.
+     */
+    template <typename T_sas>
+    static Image load(T_sas& sas, const std::string& path, bool physical = false) {
+        return load(sas, SASSegmentData::mapFile(path, SASSegmentData::MapMode::Private), physical);
+    }
+
+    /**
+     * @brief load
+     * Loads the executable in @p image into @p sas. Segments without a zero-filled part are views of @p image. If
+     * @p image is moved in, and the segments do not overlap in it, the views are split from it (see
+     * SASSegmentData::split) and written in place. Otherwise, the views are slices sharing @p image copy-on-write, so
+     * the first write to such a segment copies the bytes of that segment, and only that segment, to the heap; a copy of
+     * @p image held by the caller is thus never modified.
+     */
+    template <typename T_sas>
+    static Image load(T_sas& sas, SASSegmentData image, bool physical = false) {
+        using Segment = typename T_sas::Segment;
+        const size_t size = image.size();
+        const Reader r = header(image.data(), size);
+
+        Image info;
+        info.elfClass = r.is64 ? 64 : 32;
+        info.machine = static_cast<uint16_t>(r.read(18, 2));
+        info.entry = r.is64 ? r.read(24, 8) : r.read(24, 4);
+        const uint64_t phoff = r.is64 ? r.read(32, 8) : r.read(28, 4);
+        const uint64_t phentsize = r.read(r.is64 ? 54 : 42, 2);
+        const uint64_t phnum = r.read(r.is64 ? 56 : 44, 2);
+        if (phentsize < (r.is64 ? 56u : 32u) || phoff > size || phnum * phentsize > size - phoff) {
+            throw std::runtime_error("ELF program headers lie beyond the end of the file");
+        }
+
+        struct Load {
+            uint64_t address, offset, filesz, memsz;
+        };
+        std::vector<Load> loads;
+        for (uint64_t i = 0; i < phnum; i++) {
+            const size_t ph = static_cast<size_t>(phoff + i * phentsize);
+            if (r.read(ph, 4) != c_ptLoad) {
+                continue;
+            }
+            Load load;
+            if (r.is64) {
+                load.offset = r.read(ph + 8, 8);
+                load.address = r.read(ph + (physical ? 24 : 16), 8);
+                load.filesz = r.read(ph + 32, 8);
+                load.memsz = r.read(ph + 40, 8);
+            } else {
+                load.offset = r.read(ph + 4, 4);
+                load.address = r.read(ph + (physical ? 12 : 8), 4);
+                load.filesz = r.read(ph + 16, 4);
+                load.memsz = r.read(ph + 20, 4);
+            }
+            if (load.memsz == 0) {
+                continue;
+            }
+            if (load.filesz > load.memsz || load.offset > size || load.filesz > size - load.offset) {
+                throw std::runtime_error("Invalid ELF segment");
+            }
+            if (load.address > T_sas::c_maxAddr || load.memsz - 1 > T_sas::c_maxAddr - load.address) {
+                throw std::runtime_error("ELF segment lies beyond the end of the address space");
+            }
+            loads.push_back(load);
+        }
+        std::vector<Segment> segments(loads.size());
+        std::vector<size_t> adopted;
+        for (size_t i = 0; i < loads.size(); i++) {
+            const Load& load = loads[i];
+            segments[i].start = static_cast<decltype(segments[i].start)>(load.address);
+            if (load.filesz == load.memsz) {
+                adopted.push_back(i);
+            } else {
+                segments[i].data = SASSegmentData(static_cast<size_t>(load.memsz), 0);
+                uint8_t* dst = segments[i].data.mutableData();
+                std::memcpy(dst, image.data() + load.offset, static_cast<size_t>(load.filesz));
+            }
+        }
+
+        // Adopt the bytes from the image, splitting it if the adopted segments are disjoint within it
+        std::sort(adopted.begin(), adopted.end(),
+                  [&](size_t a, size_t b) { return loads[a].offset < loads[b].offset; });
+        std::vector<std::pair<size_t, size_t>> ranges;
+        bool disjoint = true;
+        for (size_t i : adopted) {
+            disjoint &= ranges.empty() || loads[i].offset >= ranges.back().first + ranges.back().second;
+            ranges.emplace_back(static_cast<size_t>(loads[i].offset), static_cast<size_t>(loads[i].memsz));
+        }
+        if (disjoint) {
+            std::vector<SASSegmentData> views = std::move(image).split(ranges);
+            for (size_t i = 0; i < adopted.size(); i++) {
+                segments[adopted[i]].data = std::move(views[i]);
+            }
+        } else {
+            for (size_t i = 0; i < adopted.size(); i++) {
+                segments[adopted[i]].data = image.slice(ranges[i].first, ranges[i].second);
+            }
+        }
+        sas.insertSegments(std::move(segments));
+        info.segments = loads.size();
+        return info;
+    }
+
+private:
+    constexpr static uint32_t c_ptLoad = 1;
+
+    /**
+     * @brief The Reader struct
+     * Reads fields of the ELF file in the byte order given by its header.
+     */
+    struct Reader {
+        const uint8_t* data;
+        bool is64;
+        bool bigEndian;
+
+        uint64_t read(size_t offset, unsigned n) const {
+            uint64_t value = 0;
+            for (unsigned i = 0; i < n; i++) {
+                const uint64_t byte = data[offset + i];
+                value |= bigEndian ? byte << ((n - 1 - i) * 8) : byte << (i * 8);
+            }
+            return value;
+        }
+    };
+
+    static Reader header(const uint8_t* data, size_t size) {
+        static const uint8_t c_magic[] = {0x7F, 'E', 'L', 'F'};
+        if (size < 52 || std::memcmp(data, c_magic, sizeof(c_magic)) != 0) {
+            throw std::runtime_error("Not an ELF file");
+        }
+        if ((data[4] != 1 && data[4] != 2) || (data[5] != 1 && data[5] != 2)) {
+            throw std::runtime_error("Unsupported ELF class or byte order");
+        }
+        Reader r{data, data[4] == 2, data[5] == 2};
+        if (r.is64 && size < 64) {
+            throw std::runtime_error("Not an ELF file");
+        }
+        return r;
+    }
+};
+
+#ifdef USE_SAS_NAMESPACE
+}
+#endif
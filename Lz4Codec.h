@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef USE_SAS_NAMESPACE
+namespace sas {
+#endif
+
+/**
+ * @brief The Lz4Codec class
+ * Compressor and decompressor for the LZ4 block format. A block is a sequence of (literals, match) pairs, each starting
+ * with a token holding the literal length in its upper and the match length minus 4 in its lower nibble, followed by
+ * any extra length bytes, the literals, and the 16-bit little-endian offset of the match. The final sequence consists
+ * of literals only.
+ * The compressor uses a single-entry hash table of 4-byte sequences, which favors speed over compression ratio. The
+ * decompressor validates all lengths and offsets, and throws on malformed input rather than reading or writing out of
+ * bounds.
+ */
+class Lz4Codec {
+public:
+    /**
+     * @brief compressBound
+     * @returns the maximum size of the compressed form of @p n bytes.
+     */
+    static size_t compressBound(size_t n) { return n + n / 255 + 16; }
+
+    /**
+     * @brief compress
+     * Compresses the @p n bytes at @p src into @p dst, which must hold at least compressBound(n) bytes.
+     * @returns the size of the compressed block.
+     */
+    static size_t compress(const uint8_t* src, size_t n, uint8_t* dst) {
+        uint8_t* op = dst;
+        const uint8_t* anchor = src;
+        if (n > c_mfLimit) {
+            std::vector<uint32_t> table(size_t(1) << c_hashBits, 0);
+            const uint8_t* ip = src + 1;
+            const uint8_t* const matchLimit = src + n - c_lastLiterals;
+            const uint8_t* const mfLimit = src + n - c_mfLimit;
+            while (ip < mfLimit) {
+                const uint32_t sequence = read32(ip);
+                uint32_t& entry = table[hash(sequence)];
+                const uint8_t* ref = src + entry;
+                entry = static_cast<uint32_t>(ip - src);
+                if (ref >= ip || ip - ref > c_maxOffset || read32(ref) != sequence) {
+                    // Skip faster through incompressible data
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+                while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+                size_t length = c_minMatch;
+                while (ip + length < matchLimit && ip[length] == ref[length]) {
+                    length++;
+                }
+                op = emit(op, anchor, static_cast<size_t>(ip - anchor), static_cast<uint16_t>(ip - ref), length);
+                ip += length;
+                anchor = ip;
+            }
+        }
+
+        // Last literals
+        const size_t literals = static_cast<size_t>(src + n - anchor);
+        uint8_t* token = op++;
+        *token = static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4);
+        op = putLength(op, literals);
+        if (literals > 0) {
+            // Empty input may be a null pointer, which memcpy must not be given even for 0 bytes
+            std::memcpy(op, anchor, literals);
+        }
+        return static_cast<size_t>(op + literals - dst);
+    }
+
+    /**
+     * @brief decompress
+     * Decompresses the block of @p srcSize bytes at @p src into the @p dstSize bytes at @p dst. Throws if the block is
+     * malformed, or does not decompress to exactly @p dstSize bytes.
+     */
+    static void decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+        const uint8_t* ip = src;
+        const uint8_t* const iend = src + srcSize;
+        uint8_t* op = dst;
+        uint8_t* const oend = dst + dstSize;
+        while (true) {
+            if (ip == iend) {
+                throw std::runtime_error("Truncated LZ4 block");
+            }
+            const uint8_t token = *ip++;
+            const size_t literals = getLength(ip, iend, token >> 4);
+            if (literals > static_cast<size_t>(iend - ip) || literals > static_cast<size_t>(oend - op)) {
+                throw std::runtime_error("LZ4 literals exceed the block");
+            }
+            if (literals > 0) {
+                std::memcpy(op, ip, literals);
+            }
+            ip += literals;
+            op += literals;
+            if (ip == iend) {
+                break;
+            }
+
+            if (iend - ip < 2) {
+                throw std::runtime_error("Truncated LZ4 block");
+            }
+            const size_t offset = static_cast<size_t>(ip[0]) | static_cast<size_t>(ip[1]) << 8;
+            ip += 2;
+            const size_t length = getLength(ip, iend, token & 15) + c_minMatch;
+            if (offset == 0 || offset > static_cast<size_t>(op - dst) || length > static_cast<size_t>(oend - op)) {
+                throw std::runtime_error("Invalid LZ4 match");
+            }
+            // A match may overlap the bytes being written, repeating the last offset bytes. The repeated bytes are
+            // copied in non-overlapping runs, which double in size as the copied bytes become sources themselves.
+            const uint8_t* const ref = op - offset;
+            for (size_t remaining = length; remaining > 0;) {
+                const size_t n = std::min(remaining, static_cast<size_t>(op - ref));
+                std::memcpy(op, ref, n);
+                op += n;
+                remaining -= n;
+            }
+        }
+        if (op != oend) {
+            throw std::runtime_error("LZ4 block does not match the expected size");
+        }
+    }
+
+private:
+    constexpr static unsigned c_hashBits = 12;
+    constexpr static size_t c_minMatch = 4;
+    constexpr static size_t c_lastLiterals = 5;
+    constexpr static size_t c_mfLimit = 12;
+    constexpr static ptrdiff_t c_maxOffset = 65535;
+
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t hash(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - c_hashBits); }
+
+    /**
+     * @brief putLength
+     * Writes the extra bytes of a length of @p n, given that lengths of 15 or more saturate their nibble of the token.
+     */
+    static uint8_t* putLength(uint8_t* op, size_t n) {
+        if (n >= 15) {
+            n -= 15;
+            for (; n >= 255; n -= 255) {
+                *op++ = 255;
+            }
+            *op++ = static_cast<uint8_t>(n);
+        }
+        return op;
+    }
+
+    static size_t getLength(const uint8_t*& ip, const uint8_t* iend, size_t n) {
+        if (n == 15) {
+            uint8_t byte;
+            do {
+                if (ip == iend) {
+                    throw std::runtime_error("Truncated LZ4 block");
+                }
+                byte = *ip++;
+                n += byte;
+            } while (byte == 255);
+        }
+        return n;
+    }
+
+    static uint8_t* emit(uint8_t* op, const uint8_t* literals, size_t nLiterals, uint16_t offset, size_t length) {
+        uint8_t* token = op++;
+        const size_t matchLength = length - c_minMatch;
+        *token = static_cast<uint8_t>(std::min<size_t>(nLiterals, 15) << 4 | std::min<size_t>(matchLength, 15));
+        op = putLength(op, nLiterals);
+        std::memcpy(op, literals, nLiterals);
+        op += nLiterals;
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        return putLength(op, matchLength);
+    }
+};
+
+#ifdef USE_SAS_NAMESPACE
+}
+#endif
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+
+#include "SparseAddressSpace.h"
+
+#ifdef USE_SAS_NAMESPACE
+namespace sas {
+#endif
+
+/**
+ * @brief The ShardedSparseAddressSpace class
+ * Thread-safe address space partitioned by the high-order address bits into NShards independent SparseAddressSpace
+ * instances, each guarded by its own mutex. Threads accessing different shards thus never contend. Accesses spanning
+ * multiple shards are split into one access per shard, each of which is atomic with respect to its shard only.
+ */
+template <typename T_addr, unsigned NShards, typename T_storage = IntervalStorage<T_addr>>
+class ShardedSparseAddressSpace {
+public:
+    static_assert(NShards > 0 && (NShards & (NShards - 1)) == 0, "NShards must be a power of two.");
+
+    using SAS = SparseAddressSpace<T_addr, T_storage>;
+    constexpr static T_addr c_maxAddr = SAS::c_maxAddr;
+    constexpr static unsigned c_addrBits = sizeof(T_addr) * CHAR_BIT;
+    constexpr static unsigned c_shardBits = __builtin_ctz(NShards);
+    static_assert(c_shardBits < c_addrBits, "Too many shards for the address type.");
+
+    /**
+     * @brief c_shardSizeBits
+     * log2 of the number of bytes covered by each shard.
+     */
+    constexpr static unsigned c_shardSizeBits = c_addrBits - c_shardBits;
+
+    static size_t shardIndex(T_addr address) {
+        return c_shardBits == 0 ? 0 : static_cast<size_t>(static_cast<uint64_t>(address) >> c_shardSizeBits);
+    }
+
+    uint8_t readByte(T_addr address) const {
+        Shard& shard = shardFor(address);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.sas.readByte(address);
+    }
+
+    void writeByte(T_addr address, uint8_t value) {
+        Shard& shard = shardFor(address);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.sas.writeByte(address, value);
+    }
+
+    template <typename T_v>
+    T_v readValue(T_addr address) const {
+        if (withinShard(address, sizeof(T_v))) {
+            Shard& shard = shardFor(address);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.sas.template readValue<T_v>(address);
+        }
+
+        // The value straddles a shard boundary
+        T_v value = 0;
+        for (unsigned i = 0; i < sizeof(T_v); i++)
+            value |= static_cast<T_v>(readByte(address++)) << (i * CHAR_BIT);
+        return value;
+    }
+
+    template <typename T_v>
+    void writeValue(T_addr address, T_v value, size_t nbytes) {
+        if (nbytes > sizeof(value)) {
+            throw std::runtime_error("Trying to write more bytes than what is contained in @p value");
+        }
+        if (withinShard(address, nbytes)) {
+            Shard& shard = shardFor(address);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.sas.writeValue(address, value, nbytes);
+            return;
+        }
+
+        // The value straddles a shard boundary
+        for (unsigned i = 0; i < nbytes; i++) {
+            writeByte(address++, value);
+            value >>= CHAR_BIT;
+        }
+    }
+
+    template <typename T_v>
+    void writeValue(T_addr address, T_v value) {
+        writeValue(address, value, sizeof(T_v));
+    }
+
+    /**
+     * @brief readBytes
+     * Reads @p n bytes starting at @p address into @p dst, see SparseAddressSpace::readBytes.
+     */
+    void readBytes(T_addr address, uint8_t* dst, size_t n) const {
+        forEachShardSpan(address, n, [&](Shard& shard, T_addr a, size_t offset, size_t len) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.sas.readBytes(a, dst + offset, len);
+        });
+    }
+
+    /**
+     * @brief writeBytes
+     * Writes @p n bytes from @p src starting at @p address, see SparseAddressSpace::writeBytes.
+     */
+    void writeBytes(T_addr address, const uint8_t* src, size_t n) {
+        forEachShardSpan(address, n, [&](Shard& shard, T_addr a, size_t offset, size_t len) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.sas.writeBytes(a, src + offset, len);
+        });
+    }
+
+    void insertSegment(T_addr startaddr, const std::vector<uint8_t>& data) {
+        writeBytes(startaddr, data.data(), data.size());
+    }
+
+    /**
+     * @brief segmentCount
+     * @returns the total number of segments of all shards.
+     */
+    size_t segmentCount() const {
+        size_t count = 0;
+        for (Shard& shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            count += shard.sas.segments().size();
+        }
+        return count;
+    }
+
+    void clear() {
+        for (Shard& shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.sas.clear();
+        }
+    }
+
+    /**
+     * @brief withShard
+     * Calls @p f with the address space of shard @p index while holding the lock of the shard, eg. for configuring the
+     * initialization SAS of the shard.
+     */
+    template <typename F>
+    void withShard(size_t index, F f) {
+        Shard& shard = m_shards.at(index);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        f(shard.sas);
+    }
+
+private:
+    /**
+     * @brief The Shard struct
+     * An address space and its lock, aligned such that neighboring shards never share a cache line.
+     */
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        SAS sas;
+    };
+
+    Shard& shardFor(T_addr address) const { return m_shards[shardIndex(address)]; }
+
+    static bool withinShard(T_addr address, size_t n) {
+        return static_cast<uint64_t>(n - 1) <= static_cast<uint64_t>(c_maxAddr - address) &&
+               shardIndex(address) == shardIndex(static_cast<T_addr>(address + (n - 1)));
+    }
+
+    /**
+     * @brief forEachShardSpan
+     * Splits the span of @p n bytes at @p address at shard boundaries, calling @p f(shard, address, offset, length)
+     * for each part, where offset is relative to the start of the span.
+     */
+    template <typename F>
+    void forEachShardSpan(T_addr address, size_t n, F f) const {
+        if (n > 0 && static_cast<uint64_t>(n - 1) > static_cast<uint64_t>(c_maxAddr - address)) {
+            throw std::runtime_error("Trying to access bytes beyond the end of the address space");
+        }
+        size_t offset = 0;
+        while (offset < n) {
+            // Bytes are counted up to the last byte of the shard, excluding the first, such that the count of a shard
+            // spanning the entire address space does not overflow
+            const uint64_t shardLast = c_shardBits == 0 ? static_cast<uint64_t>(c_maxAddr)
+                                                        : ((uint64_t(shardIndex(address)) + 1) << c_shardSizeBits) - 1;
+            const size_t len = static_cast<size_t>(
+                std::min<uint64_t>(n - offset - 1, shardLast - static_cast<uint64_t>(address)) + 1);
+            f(shardFor(address), address, offset, len);
+            offset += len;
+            address += static_cast<T_addr>(len);
+        }
+    }
+
+    /**
+     * @brief m_shards
+     * Mutable, as reads of a SparseAddressSpace may modify its physical state; see
+     * SparseAddressSpace::segmentForAddress.
+     */
+    mutable std::array<Shard, NShards> m_shards;
+};
+
+#ifdef USE_SAS_NAMESPACE
+}
+#endif
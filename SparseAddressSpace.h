@@ -1,366 +1,3010 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
-#include <set>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <limits.h>
 
-#include "external/intervaltree/IntervalTree.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SAS_HAVE_MMAP 1
+#endif
+
+#include "Lz4Codec.h"
+
+#ifdef USE_SAS_NAMESPACE
+namespace sas {
+#endif
+
+/**
+ * @brief The SASSegmentData class
+ * The bytes of a segment. Copies of segment data share the same underlying buffer, which is copied on the first write
+ * through any of the sharing copies (copy-on-write). Copying segment data is thus O(1), regardless of its size.
+ * Bytes are read through data()/operator[], whereas all modifications must go through mutableData(), prepend() or
+ * append(), which ensure that the buffer is private to this copy.
+ * The buffer is either owned heap memory, or a view of a memory-mapped file; see mapFile(). Segment data may also be
+ * deferred, in which case its buffer is only allocated and filled upon the first access to its bytes; see deferred().
+ * Buffers reallocated by prepend() and append() reserve headroom at the extended end, as large as the bytes themselves,
+ * such that repeatedly extending segment data at either end moves each byte an amortized constant number of times.
+ */
+class SASSegmentData {
+public:
+    /**
+     * @brief The MapMode enum
+     * How a file is mapped by mapFile():
+     * - ReadOnly: the mapping is never written. The bytes are copied to the heap upon the first write.
+     * - Private: the mapping is writable and private to the process. Upon a write, only the written page is copied,
+     *   by the operating system.
+     */
+    enum class MapMode { ReadOnly, Private };
+
+    SASSegmentData() {}
+    SASSegmentData(size_t n, uint8_t value) : m_buffer(allocate(n)), m_size(n) { std::memset(m_buffer.get(), value, n); }
+    SASSegmentData(std::vector<uint8_t> bytes) : m_size(bytes.size()) {
+        // Adopt the vector as the buffer, avoiding a copy
+        auto vec = std::make_shared<std::vector<uint8_t>>(std::move(bytes));
+        m_buffer = std::shared_ptr<uint8_t>(vec, vec->data());
+    }
+    /**
+     * Adopts the @p n writable bytes at @p buffer, which may point into a larger allocation, such as a file mapping.
+     * As for copies of segment data, the bytes are copied upon the first write if @p buffer is still shared.
+     */
+    SASSegmentData(std::shared_ptr<uint8_t> buffer, size_t n) : m_buffer(std::move(buffer)), m_size(n) {}
+
+    /**
+     * @brief mapFile
+     * @returns a view of @p length bytes of the file at @p path, starting at byte @p offset. A @p length of 0 maps the
+     * remainder of the file. The file is mapped according to @p mode, such that pages are only read from the file once
+     * accessed. Where memory mapping is unsupported, the bytes are read into the heap instead. Throws if the file
+     * cannot be opened or is smaller than the requested range.
+     */
+    static SASSegmentData mapFile(const std::string& path, MapMode mode = MapMode::Private, uint64_t offset = 0,
+                                  size_t length = 0) {
+#ifdef SAS_HAVE_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not stat " + path);
+        }
+        try {
+            length = mappedLength(path, static_cast<uint64_t>(st.st_size), offset, length);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        if (length == 0) {
+            ::close(fd);
+            return SASSegmentData();
+        }
+
+        // Mappings must start at a page boundary
+        const uint64_t pageOffset = offset % static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        const size_t mappedSize = static_cast<size_t>(pageOffset) + length;
+        const int prot = mode == MapMode::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+        void* mapping = ::mmap(nullptr, mappedSize, prot, MAP_PRIVATE, fd, static_cast<off_t>(offset - pageOffset));
+        ::close(fd);
+        if (mapping != MAP_FAILED) {
+            std::shared_ptr<uint8_t> base(static_cast<uint8_t*>(mapping),
+                                          [mappedSize](uint8_t* p) { ::munmap(p, mappedSize); });
+            SASSegmentData view(std::shared_ptr<uint8_t>(base, base.get() + pageOffset), length);
+            view.m_mapped = true;
+            view.m_readOnly = mode == MapMode::ReadOnly;
+            return view;
+        }
+#endif
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("Could not open " + path);
+        }
+        length = mappedLength(path, static_cast<uint64_t>(file.tellg()), offset, length);
+        SASSegmentData bytes;
+        if (length > 0) {
+            bytes.m_buffer = allocate(length);
+            bytes.m_size = length;
+            file.seekg(static_cast<std::streamoff>(offset));
+            file.read(reinterpret_cast<char*>(bytes.m_buffer.get()), static_cast<std::streamsize>(length));
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief deferred
+     * @returns segment data of @p n bytes, which are filled by @p fill upon the first access to them, eg. by
+     * decompressing them. Copies made before the first access share the filled buffer, such that @p fill is called
+     * at most once, even if the copies are accessed from different threads.
+     */
+    static SASSegmentData deferred(size_t n, std::function<void(uint8_t*)> fill) {
+        SASSegmentData data;
+        data.m_size = n;
+        if (n > 0) {
+            data.m_deferred = std::make_shared<Deferred>();
+            data.m_deferred->fill = std::move(fill);
+        }
+        return data;
+    }
+
+    /**
+     * @brief slice
+     * @returns a view of the @p n bytes at @p offset, sharing the buffer of this segment data copy-on-write.
+     */
+    SASSegmentData slice(size_t offset, size_t n) const {
+        if (offset > m_size || n > m_size - offset) {
+            throw std::runtime_error("Slice exceeds the segment data");
+        }
+        materialize();
+        SASSegmentData view(*this);
+        view.m_buffer = std::shared_ptr<uint8_t>(m_buffer, m_buffer.get() + offset);
+        view.m_size = n;
+        view.m_front = 0;
+        view.m_back = 0;
+        return view;
+    }
+
+    /**
+     * @brief split
+     * Splits the bytes into views of the disjoint @p ranges of (offset, size), sorted by offset. Unlike slices, the
+     * views do not share a buffer with each other, so each view may be written in place; this object is thus consumed.
+     * If the buffer is shared with other segment data, the views are slices instead.
+     */
+    std::vector<SASSegmentData> split(const std::vector<std::pair<size_t, size_t>>& ranges) && {
+        size_t end = 0;
+        for (const auto& range : ranges) {
+            if (range.first < end || range.first > m_size || range.second > m_size - range.first) {
+                throw std::runtime_error("Split ranges must be sorted, disjoint and within the segment data");
+            }
+            end = range.first + range.second;
+        }
+
+        materialize();
+        std::vector<SASSegmentData> views;
+        views.reserve(ranges.size());
+        const bool shared = isShared();
+        for (const auto& range : ranges) {
+            if (shared) {
+                views.push_back(slice(range.first, range.second));
+                continue;
+            }
+            // Each view owns a reference to the buffer through the deleter of its own control block
+            SASSegmentData view(*this);
+            view.m_buffer = std::shared_ptr<uint8_t>(m_buffer.get() + range.first, [buffer = m_buffer](uint8_t*) {});
+            view.m_size = range.second;
+            view.m_front = 0;
+            view.m_back = 0;
+            views.push_back(std::move(view));
+        }
+        *this = SASSegmentData();
+        return views;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const uint8_t* data() const {
+        materialize();
+        return m_buffer.get();
+    }
+    const uint8_t* begin() const { return data(); }
+    const uint8_t* end() const { return data() + m_size; }
+    uint8_t operator[](size_t i) const { return data()[i]; }
+
+    /**
+     * @brief isShared
+     * @returns true if the buffer is shared with other copies of this segment data.
+     */
+    bool isShared() const {
+        materialize();
+        if (m_buffer.use_count() > 1) {
+            return true;
+        }
+        // use_count() is a relaxed load. The fence pairs it with the release of the references of other owners, which
+        // may have been dropped on other threads, such that their accesses to the bytes happen before writes in place.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return false;
+    }
+
+    /**
+     * @brief isDeferred
+     * @returns true if the bytes have not yet been filled through this copy of deferred segment data, see deferred().
+     */
+    bool isDeferred() const { return m_deferred != nullptr; }
+
+    /**
+     * @brief isMapped
+     * @returns true if the bytes are a view of a memory-mapped file, see mapFile().
+     */
+    bool isMapped() const { return m_mapped; }
+
+    /**
+     * @brief mutableData
+     * @returns a writable pointer to the bytes. If the buffer is shared or a read-only mapping, a private copy of it is
+     * made first.
+     */
+    uint8_t* mutableData() {
+        if (isShared() || m_readOnly) {
+            replace(0, 0);
+        }
+        return m_buffer.get();
+    }
+
+    /**
+     * @brief prepend
+     * Inserts @p n bytes from @p src in front of the existing bytes. The bytes are written into the headroom in front of
+     * the buffer if it is private and has room for them. Otherwise, the buffer is reallocated with headroom in front.
+     */
+    void prepend(const uint8_t* src, size_t n) {
+        if (n > m_front || isShared()) {
+            replace(n + std::max(n, m_size), m_back);
+        }
+        m_buffer = std::shared_ptr<uint8_t>(m_buffer, m_buffer.get() - n);
+        m_front -= n;
+        m_size += n;
+        std::memcpy(m_buffer.get(), src, n);
+    }
+
+    /**
+     * @brief append
+     * Inserts @p n bytes from @p src after the existing bytes. The bytes are written into the headroom after the buffer
+     * if it is private and has room for them. Otherwise, the buffer is reallocated with headroom at the back.
+     */
+    void append(const uint8_t* src, size_t n) {
+        if (n > m_back || isShared()) {
+            replace(m_front, n + std::max(n, m_size));
+        }
+        std::memcpy(m_buffer.get() + m_size, src, n);
+        m_back -= n;
+        m_size += n;
+    }
+
+    /**
+     * @brief capacity
+     * @returns the number of bytes which the bytes may grow to through prepend() and append() without reallocating,
+     * given that the buffer is private.
+     */
+    size_t capacity() const { return m_front + m_size + m_back; }
+
+    bool operator==(const SASSegmentData& other) const {
+        return m_size == other.m_size && (m_size == 0 || std::memcmp(data(), other.data(), m_size) == 0);
+    }
+
+private:
+    static std::shared_ptr<uint8_t> allocate(size_t n) {
+        return std::shared_ptr<uint8_t>(new uint8_t[n], std::default_delete<uint8_t[]>());
+    }
+
+    /**
+     * @brief mappedLength
+     * @returns the number of bytes to map from a file of @p fileSize bytes, see mapFile().
+     */
+    static size_t mappedLength(const std::string& path, uint64_t fileSize, uint64_t offset, size_t length) {
+        if (offset > fileSize || length > fileSize - offset) {
+            throw std::runtime_error("Requested range exceeds the size of " + path);
+        }
+        return length == 0 ? static_cast<size_t>(fileSize - offset) : length;
+    }
+
+    /**
+     * @brief replace
+     * Replaces the buffer with a private buffer holding the existing bytes, with @p front and @p back bytes of headroom
+     * in front of and after the existing bytes.
+     */
+    void replace(size_t front, size_t back) {
+        materialize();
+        auto buffer = allocate(front + m_size + back);
+        if (m_size > 0) {
+            std::memcpy(buffer.get() + front, m_buffer.get(), m_size);
+        }
+        m_buffer = std::shared_ptr<uint8_t>(buffer, buffer.get() + front);
+        m_front = front;
+        m_back = back;
+        m_mapped = false;
+        m_readOnly = false;
+    }
+
+    /**
+     * @brief The Deferred struct
+     * The fill function of deferred segment data, and the buffer once filled, shared by all copies of the data.
+     */
+    struct Deferred {
+        std::function<void(uint8_t*)> fill;
+        std::once_flag once;
+        std::shared_ptr<uint8_t> buffer;
+    };
+
+    /**
+     * @brief materialize
+     * Fills the buffer of deferred segment data, and adopts it as the buffer of this copy. If no other copy remains to
+     * adopt the buffer, the buffer is not retained by the shared state, such that it is not considered to be shared.
+     */
+    void materialize() const {
+        if (!m_deferred) {
+            return;
+        }
+        Deferred& deferred = *m_deferred;
+        std::call_once(deferred.once, [&] {
+            auto buffer = allocate(m_size);
+            deferred.fill(buffer.get());
+            deferred.buffer = std::move(buffer);
+            deferred.fill = nullptr;
+        });
+        m_buffer = deferred.buffer;
+        if (m_deferred.use_count() == 1) {
+            deferred.buffer.reset();
+        }
+        m_deferred.reset();
+    }
+
+    /**
+     * @brief m_buffer
+     * Mutable, as deferred segment data is filled upon the first read; see materialize().
+     */
+    mutable std::shared_ptr<uint8_t> m_buffer;
+    mutable std::shared_ptr<Deferred> m_deferred;
+    size_t m_size = 0;
+
+    /**
+     * @brief m_front, m_back
+     * Headroom of the buffer in front of and after the bytes, which may only be written while the buffer is private.
+     * Views of parts of a buffer have no headroom, as the surrounding bytes belong to other views.
+     */
+    size_t m_front = 0;
+    size_t m_back = 0;
+
+    /**
+     * @brief m_mapped
+     * Whether the buffer is a view of a memory-mapped file. m_readOnly is set if the mapping must never be written.
+     */
+    bool m_mapped = false;
+    bool m_readOnly = false;
+};
+
+/**
+ * @brief The SASSegment struct
+ * Represents a segment of contiguous memory within an address space of T_addr addresses.
+ */
+template <typename T_addr>
+struct SASSegment {
+    /**
+     * @brief start: address of the first byte in this segment
+     */
+    T_addr start;
+    /**
+     * @brief end: address of the last byte in this segment
+     */
+    inline T_addr end() const { return start + static_cast<T_addr>(data.size() - 1); }
+    inline bool contains(const SASSegment& other) const { return start <= other.start && end() >= other.end(); }
+    inline bool contains(const T_addr addr) const { return static_cast<T_addr>(addr - start) < data.size(); }
+
+    bool operator==(const SASSegment& other) const { return start == other.start && data == other.data; }
+
+    SASSegmentData data;
+
+    /**
+     * @brief fromInit: true if this segment was created by a reset with dirty tracking enabled, as a copy of a segment of
+     * the initialization SAS, and has since kept the exact bounds of that segment. Segments created by coalescing are
+     * never fromInit. See SparseAddressSpace::setDirtyTracking.
+     */
+    bool fromInit = false;
+    /**
+     * @brief dirtyChunks: bitmap of the chunks of this segment which were written since the last reset. Only maintained
+     * for fromInit segments, and allocated upon the first write.
+     */
+    std::vector<uint64_t> dirtyChunks;
+};
+
+/**
+ * @brief The SegmentPool class
+ * Arena of segment objects. Segments are allocated in blocks of c_blockSize segments, and released segments are
+ * recycled through a free list, such that creating and coalescing segments does not allocate segment objects
+ * individually. Segments are referenced through plain pointers, which remain valid until the segment is released.
+ */
+template <typename T_segment>
+class SegmentPool {
+public:
+    T_segment* allocate() {
+        if (!m_free.empty()) {
+            T_segment* seg = m_free.back();
+            m_free.pop_back();
+            return seg;
+        }
+        if (m_blocks->empty() || m_used == c_blockSize) {
+            m_blocks->emplace_back(new T_segment[c_blockSize]);
+            m_used = 0;
+        }
+        return &m_blocks->back()[m_used++];
+    }
+
+    void release(T_segment* seg) {
+        // Release the bytes of the segment; only the segment object itself is recycled
+        *seg = T_segment();
+        m_free.push_back(seg);
+        if (!m_shared.empty()) {
+            m_shared.erase(seg);
+        }
+    }
+
+    /**
+     * @brief share
+     * @returns a shared pointer to @p seg. All pointers to a segment share a control block of their own, which the
+     * pool drops once the segment is released or the pool is destroyed. Weak pointers to a segment thus expire with it
+     * rather than observing a later segment recycled into its place. The pointers keep the memory of the segment alive.
+     */
+    std::shared_ptr<T_segment> share(T_segment* seg) {
+        std::shared_ptr<T_segment>& handle = m_shared[seg];
+        if (!handle) {
+            handle = std::shared_ptr<T_segment>(seg, [blocks = m_blocks](T_segment*) {});
+        }
+        return handle;
+    }
+
+private:
+    constexpr static size_t c_blockSize = 256;
+    using Blocks = std::vector<std::unique_ptr<T_segment[]>>;
+    std::shared_ptr<Blocks> m_blocks = std::make_shared<Blocks>();
+    std::vector<T_segment*> m_free;
+    size_t m_used = 0;
+
+    /**
+     * @brief m_shared
+     * Control blocks of the segments handed out through share(), see share().
+     */
+    std::unordered_map<const T_segment*, std::shared_ptr<T_segment>> m_shared;
+};
+
+/**
+ * @brief The SASCoalescing enum
+ * When segments are coalesced with adjacent segments, see SparseAddressSpace::setCoalescing:
+ * - Eager: upon inserting or creating a segment next to an existing segment.
+ * - DeferShared: as Eager, unless coalescing would copy bytes shared copy-on-write. Such segments are coalesced upon
+ *   compact(), or automatically once the fragmentation exceeds the compaction threshold.
+ * - Deferred: never upon insertion; all adjacent segments are coalesced upon compact(), or automatically once the
+ *   fragmentation exceeds the compaction threshold.
+ */
+enum class SASCoalescing { Eager, DeferShared, Deferred };
+
+/* Storage policies
+ * The segments of a SparseAddressSpace are kept by a storage policy, which determines how segments are shaped, indexed
+ * and created. A storage policy provides:
+ * - T_storage(unsigned minSegSize)
+ * - Segment* find(T_addr addr) const: the segment containing @p addr, or nullptr.
+ * - const Segment* upperNeighbor(T_addr addr, T_addr last) const: the closest segment starting above @p addr and at or
+ *   below @p last (by default, the end of the address space), or nullptr.
+ * - void insert(Segment&& segment, F_removed removed): inserts @p segment, such that the bytes of @p segment take
+ *   precedence over any existing bytes at the same addresses. @p removed is called for each segment which is removed
+ *   from the storage.
+ * - void insertDisjoint(Segment&& segment): inserts @p segment with its bounds unchanged. @p segment must not overlap
+ *   any existing segment, and is not coalesced with adjacent segments.
+ * - void insertBulk(std::vector<Segment>&& segments, F_removed removed): inserts all of @p segments, as if inserted
+ *   one at a time in order, such that later segments take precedence over earlier ones.
+ * - void createMissing(T_addr addr, F_removed removed): creates a segment containing @p addr, which must not already
+ *   be contained in any segment. The bytes of the segment hold the background value.
+ * - void setBackground(uint8_t value): sets the background value, 0 by default.
+ * - void setMaxSegSize(size_t n, F_removed removed): limits segments to at most @p n bytes, or lifts the limit if @p n
+ *   is 0 (default). @p removed is called for each segment which is removed from the storage.
+ * - void setCoalescing(SASCoalescing mode): when inserted segments are coalesced with adjacent segments, see
+ *   SASCoalescing. Segments whose coalescing is deferred are left adjacent until compact().
+ * - void compact(F_removed removed): coalesces all adjacent segments.
+ * - double fragmentation() const: an estimate of the fraction of segments which compact() would coalesce.
+ * - void forEach(F f) (const): calls @p f for each segment, in address order.
+ * - void removeIf(F_pred pred, F_removed removed): removes all segments for which @p pred returns true.
+ * - SegSPtr share(const Segment& segment) const: a shared pointer to @p segment, for handing segments out to users.
+ *   Weak pointers to @p segment must expire once it is removed.
+ * - size_t size() const: the number of segments.
+ * - void clear(): removes all segments.
+ * - void assignShared(const T_storage& other): replaces all segments with copies of the segments of @p other, sharing
+ *   their bytes copy-on-write. Only the bounds and bytes of the segments are copied. Must be O(number of segments).
+ * Storage policies are movable but not copyable, as copies must be made explicitly through assignShared.
+ * Inserting a copy of a segment of another storage of the same policy into a storage with no overlapping or adjacent
+ * segments must not copy the bytes of the segment.
+ * Segments are owned by the storage, and are referenced through plain pointers which remain valid until the segment is
+ * removed.
+ */
+
+/* Growth policies
+ * The growth policy of an IntervalStorage determines the bounds of the segment created upon accessing an unmapped
+ * address, before the segment is fitted in between its neighbors. A growth policy provides:
+ * - SASGrowth grow(T_addr addr, const SASSegment<T_addr>* lower, const SASSegment<T_addr>* upper, unsigned minSegSize):
+ *   the number of bytes to allocate below and above @p addr, given the closest segments below and above @p addr, if
+ *   any. Called once for each created segment, such that policies may track the pattern of accesses.
+ * Growth policies are default-constructed by the storage.
+ */
+
+/**
+ * @brief The SASGrowth struct
+ * Number of bytes to allocate below and above an accessed address. Unless truncateOnly is set, bytes which would lie
+ * below the bottom of the address space or overlap the lower neighbor are allocated above the segment instead, such
+ * that the segment keeps its size. Bytes overlapping the upper neighbor are always dropped.
+ */
+struct SASGrowth {
+    uint64_t below;
+    uint64_t above;
+    bool truncateOnly = false;
+};
+
+/**
+ * @brief The CenteredGrowth struct
+ * Creates segments of minSegSize bytes centered on the accessed address. This is the default growth policy.
+ */
+struct CenteredGrowth {
+    template <typename T_addr>
+    SASGrowth grow(T_addr, const SASSegment<T_addr>*, const SASSegment<T_addr>*, unsigned minSegSize) {
+        return {minSegSize / 2, minSegSize / 2};
+    }
+};
+
+/**
+ * @brief The StrideGrowth struct
+ * Creates segments of minSegSize bytes extending from the accessed address in the direction of the accesses to
+ * unmapped addresses: downwards if the previous such access was above the address, and upwards otherwise. Sequential
+ * writers, such as memsets and stacks, thus have each new segment placed ahead of them.
+ */
+struct StrideGrowth {
+    template <typename T_addr>
+    SASGrowth grow(T_addr addr, const SASSegment<T_addr>*, const SASSegment<T_addr>*, unsigned minSegSize) {
+        const bool down = m_hasLast && addr < m_last;
+        m_last = addr;
+        m_hasLast = true;
+        return down ? SASGrowth{minSegSize - 1, 0} : SASGrowth{0, minSegSize - 1};
+    }
+
+    uint64_t m_last = 0;
+    bool m_hasLast = false;
+};
+
+/**
+ * @brief The GeometricGrowth struct
+ * Creates a segment as large as its neighbor when an address directly adjacent to the neighbor is accessed, such that
+ * a segment being extended doubles in size with each extension, up to MaxGrowth bytes per extension. The cost of
+ * coalescing is thus amortized over the size of the segment. Other accesses create segments of minSegSize bytes
+ * centered on the address.
+ */
+template <uint64_t MaxGrowth = 1 << 20>
+struct GeometricGrowth {
+    template <typename T_addr>
+    SASGrowth grow(T_addr addr, const SASSegment<T_addr>* lower, const SASSegment<T_addr>* upper,
+                   unsigned minSegSize) {
+        if (lower && addr - lower->end() == 1) {
+            return {0, extension(lower->data.size(), minSegSize)};
+        }
+        if (upper && upper->start - addr == 1) {
+            return {extension(upper->data.size(), minSegSize), 0};
+        }
+        return {minSegSize / 2, minSegSize / 2};
+    }
+
+private:
+    static uint64_t extension(size_t neighborSize, unsigned minSegSize) {
+        return std::min<uint64_t>(std::max<uint64_t>(neighborSize, minSegSize), MaxGrowth) - 1;
+    }
+};
+
+/**
+ * @brief The PageAlignedGrowth struct
+ * Creates segments covering the aligned page of 2^PageBits bytes containing the accessed address, truncated to the
+ * parts of the page not covered by other segments. Segment bounds thus never cross page boundaries of the accesses.
+ */
+template <unsigned PageBits = 12>
+struct PageAlignedGrowth {
+    template <typename T_addr>
+    SASGrowth grow(T_addr addr, const SASSegment<T_addr>*, const SASSegment<T_addr>*, unsigned) {
+        constexpr uint64_t mask = (uint64_t(1) << PageBits) - 1;
+        const uint64_t offset = static_cast<uint64_t>(addr) & mask;
+        return {offset, mask - offset, true};
+    }
+};
+
+/**
+ * @brief The IntervalStorage class
+ * Storage policy keeping variable-sized segments in an ordered index. Segments are coalesced with any overlapping and
+ * adjacent segments upon insertion, and thus grow to match the accessed regions of the address space. The bounds of
+ * segments created upon accessing unmapped addresses are determined by the growth policy T_growth; see CenteredGrowth.
+ */
+template <typename T_addr, typename T_growth = CenteredGrowth>
+class IntervalStorage {
+public:
+    /* All boundary arithmetic is performed within T_addr, with explicit handling of the top of the address space
+     * wherever the address following the last byte of a segment is required. This allows for the full range of
+     * T_addr, including 64-bit addresses, to be used.
+     */
+    static_assert(std::is_unsigned<T_addr>::value, "Address type must be an unsigned integer type.");
+    constexpr static T_addr c_maxAddr = std::numeric_limits<T_addr>::max();
+
+    using Segment = SASSegment<T_addr>;
+    using SegSPtr = std::shared_ptr<Segment>;
+    using Pool = SegmentPool<Segment>;
+    /** @brief SASData
+     * Ordered index of the segments in the address space, keyed on Segment::start. Segments never overlap, so the
+     * segment containing an address is always the greatest-keyed segment with start <= address. Insertion, erasure and
+     * neighbor lookup are all O(log n) in the number of segments.
+     */
+    using SASData = std::map<T_addr, Segment*>;
+
+    IntervalStorage(const unsigned minSegSize) : m_minSegSize(minSegSize) {
+        assert(m_minSegSize % 2 == 1 && "m_minSegSize must be an uneven value");
+        assert(m_minSegSize >= 3 && "m_minSegSize must be at least 3");
+        clear();
+    }
+    IntervalStorage(IntervalStorage&&) = default;
+    IntervalStorage(const IntervalStorage&) = delete;
+    IntervalStorage& operator=(const IntervalStorage&) = delete;
+
+    Segment* find(T_addr address) const {
+        // The only candidate is the last segment starting at or below the address
+        auto it = data.upper_bound(address);
+        if (it == data.begin()) {
+            return nullptr;
+        }
+        Segment* seg = std::prev(it)->second;
+        return seg->contains(address) ? seg : nullptr;
+    }
+
+    /**
+     * @brief upperNeighbor
+     * @returns the closest segment starting above @p addr and at or below @p last, or nullptr if no such segment
+     * exists.
+     */
+    const Segment* upperNeighbor(T_addr addr, T_addr last = std::numeric_limits<T_addr>::max()) const {
+        auto it = data.upper_bound(addr);
+        return it == data.end() || it->first > last ? nullptr : it->second;
+    }
+
+    /**
+     * @brief insert
+     * Inserts memory segment @p segment at the specified starting address.
+     * If the segment overlaps any other memory segments, these will be coalesced, with overlapping
+     * memory values being taken from the newly inserted segment. We only check for overlaps at the
+     * start and stop address. Any segments contained within the newly inserted segment will be
+     * deleted.
+     * With a maximum segment size (see setMaxSegSize), a segment larger than the maximum is inserted as a run of
+     * adjacent segments of the maximum size. Neighbors are only coalesced with the new segment if the result does not
+     * exceed the maximum; otherwise, the parts of them overlapping the new segment are trimmed off instead, and a trimmed
+     * neighbor is coalesced with the segment on its other side if they now fit together. No two adjacent segments thus
+     * fit within the maximum together, which bounds the number of segments covering a range to twice its size divided
+     * by the maximum. The same holds for neighbors which do not contain or are not contained in the new segment, and
+     * whose coalescing is deferred (see setCoalescing), except that trimmed neighbors are left to compact().
+     */
+    template <typename F_removed>
+    void insert(Segment&& newSegment, F_removed removed) {
+        if (m_maxSegSize != 0 && newSegment.data.size() > m_maxSegSize) {
+            for (Segment& chunk : splitSegment(std::move(newSegment))) {
+                insert(std::move(chunk), removed);
+            }
+            return;
+        }
+
+        Segment& segment = *m_pool->allocate();
+        segment = std::move(newSegment);
+        bool lowerTrimmed = false;
+        bool upperTrimmed = false;
+
+        // Coalesce with a lower segment which overlaps or is adjacent to the start of the new segment. Only the closest
+        // segment starting below the new segment can do so, given that segments never overlap.
+        auto it = data.upper_bound(segment.start);
+        if (it != data.begin()) {
+            auto lower = std::prev(it);
+            Segment& lowerSeg = *lower->second;
+            if (reaches(lowerSeg.end(), segment.start)) {
+                if (coalesces(lowerSeg, segment)) {
+                    coalesce(lowerSeg, segment);
+                    removed(&lowerSeg);
+                    m_pool->release(&lowerSeg);
+                    it = data.erase(lower);
+                } else {
+                    if (lowerSeg.end() >= segment.start) {
+                        // Neither segment contains the other; keep the bytes of the lower segment below the new one
+                        trim(lowerSeg, 0, static_cast<size_t>(segment.start - lowerSeg.start));
+                        lowerTrimmed = true;
+                    }
+                    deferMerge(lowerSeg, segment);
+                }
+            }
+        }
+
+        // Walk the segments starting within the new segment (or adjacent to its end). Segments fully contained within
+        // the new segment are removed, whereas a segment overlapping the end of the new segment is coalesced into it.
+        // Segments starting at the address following segment.end() are adjacent, and are thus coalesced as well.
+        while (it != data.end() && reaches(segment.end(), it->first)) {
+            Segment& upperSeg = *it->second;
+            if (!coalesces(upperSeg, segment)) {
+                // Only the last segment reaching the new segment may exceed it. Keep its bytes above the new segment,
+                // which changes its start address and thus its key in the index.
+                if (upperSeg.start <= segment.end()) {
+                    auto node = data.extract(it);
+                    const size_t overlap = static_cast<size_t>(segment.end() - upperSeg.start) + 1;
+                    trim(upperSeg, overlap, upperSeg.data.size() - overlap);
+                    node.key() = upperSeg.start;
+                    it = data.insert(std::move(node)).position;
+                    upperTrimmed = true;
+                }
+                deferMerge(upperSeg, segment);
+                break;
+            }
+            if (!segment.contains(upperSeg)) {
+                coalesce(upperSeg, segment);
+            }
+            removed(&upperSeg);
+            m_pool->release(&upperSeg);
+            it = data.erase(it);
+        }
+
+        // Insert the (coalesced) new segment. Only the segments which were coalesced into it have been touched.
+        auto pos = data.emplace_hint(it, segment.start, &segment);
+
+        // A trimmed neighbor never fits together with the new segment, but may now fit with the segment beyond it
+        if (lowerTrimmed && std::prev(pos) != data.begin()) {
+            mergeAdjacent(std::prev(pos, 2), removed);
+        }
+        if (upperTrimmed && std::next(pos, 2) != data.end()) {
+            mergeAdjacent(std::next(pos), removed);
+        }
+    }
+
+    /**
+     * @brief insertDisjoint
+     * Inserts @p segment into the index as it is, without coalescing it with adjacent segments. Used for restoring
+     * copies of segments of another storage, which keep the bounds of the copied segment.
+     */
+    void insertDisjoint(Segment&& segment) {
+        Segment* seg = m_pool->allocate();
+        *seg = std::move(segment);
+        assert(!find(seg->start) && !find(seg->end()));
+        data.emplace(seg->start, seg);
+    }
+
+    /**
+     * @brief insertBulk
+     * Inserts all of @p segments with the same result as inserting them one at a time in order, ie. bytes of later
+     * segments take precedence over bytes of earlier segments and of existing segments. The new segments are sorted,
+     * and merged with the existing segments in a single linear pass, in which each run of overlapping and adjacent
+     * segments is coalesced into a single segment. The index is then built once. Segments which are neither overlapping
+     * nor adjacent to any other segment are adopted without copying their bytes. Adjacent segments do not join a run if
+     * coalescing is deferred for them, see setCoalescing.
+     */
+    template <typename F_removed>
+    void insertBulk(std::vector<Segment>&& segments, F_removed removed) {
+        // Move the new segments into the pool in input order, and sort compact entries describing them rather than the
+        // segments themselves. Input which is already in order, as from loaders, is not sorted at all.
+        std::vector<BulkEntry> entries(segments.size());
+        for (size_t i = 0; i < segments.size(); i++) {
+            Segment* seg = m_pool->allocate();
+            *seg = std::move(segments[i]);
+            entries[i] = {seg->start, seg->end(), i + 1, seg};
+        }
+        if (!std::is_sorted(entries.begin(), entries.end(), bulkEntryLess)) {
+            sortByStart(entries);
+        }
+
+        std::vector<BulkEntry> run;
+        T_addr runEnd = 0;
+        SASData merged;
+        bool lastSplit = false;
+        bool runShared = false;
+
+        auto flush = [&] {
+            const T_addr runStart = run.front().start;
+            Segment* seg = run.front().segment;
+            if (run.size() > 1) {
+                // Copy the members into the coalesced segment in order of priority, such that later segments win
+                std::sort(run.begin(), run.end(),
+                          [](const BulkEntry& a, const BulkEntry& b) { return a.priority < b.priority; });
+                SASSegmentData bytes(static_cast<size_t>(runEnd - runStart) + 1, 0);
+                uint8_t* dst = bytes.mutableData();
+                for (const BulkEntry& m : run) {
+                    std::memcpy(dst + (m.start - runStart), m.segment->data.data(), m.segment->data.size());
+                    if (m.priority == 0) {
+                        removed(m.segment);
+                    }
+                    m_pool->release(m.segment);
+                }
+                seg = m_pool->allocate();
+                seg->start = runStart;
+                seg->data = std::move(bytes);
+            }
+            if (lastSplit) {
+                // The last part of the previous run was not considered when forming this run, but may fit with it
+                auto last = std::prev(merged.end());
+                if (reaches(last->second->end(), runStart) && fits(last->first, seg->end())) {
+                    if (defers(*last->second, *seg)) {
+                        m_pendingMerges++;
+                    } else {
+                        coalesce(*last->second, *seg);
+                        seg->fromInit = false;
+                        seg->dirtyChunks.clear();
+                        m_pool->release(last->second);
+                        merged.erase(last);
+                    }
+                }
+            }
+            lastSplit = m_maxSegSize != 0 && seg->data.size() > m_maxSegSize;
+            if (lastSplit) {
+                if (run.size() == 1 && run.front().priority == 0) {
+                    removed(seg);
+                }
+                for (Segment& chunk : splitSegment(std::move(*seg))) {
+                    Segment* chunkSeg = m_pool->allocate();
+                    *chunkSeg = std::move(chunk);
+                    merged.emplace_hint(merged.end(), chunkSeg->start, chunkSeg);
+                }
+                m_pool->release(seg);
+            } else {
+                merged.emplace_hint(merged.end(), seg->start, seg);
+            }
+            run.clear();
+        };
+        auto add = [&](const BulkEntry& entry) {
+            // Overlapping segments always join the run, whereas adjacent segments only join it if the run stays within
+            // the maximum segment size, and coalescing is not deferred for them. Joining a run copies all of its bytes.
+            const bool shared = m_coalescing == SASCoalescing::DeferShared && sharesBytes(*entry.segment);
+            bool joins = !run.empty() && entry.start <= runEnd;
+            if (!run.empty() && !joins && reaches(runEnd, entry.start) && fits(run.front().start, entry.end)) {
+                joins = m_coalescing != SASCoalescing::Deferred && !runShared && !shared;
+                m_pendingMerges += !joins;
+            }
+            if (joins) {
+                runEnd = std::max(runEnd, entry.end);
+                runShared |= shared;
+            } else {
+                if (!run.empty()) {
+                    flush();
+                }
+                runEnd = entry.end;
+                runShared = shared;
+            }
+            run.push_back(entry);
+        };
+
+        // Merge the existing segments (priority 0) and the new segments in order of their start addresses
+        auto it = data.begin();
+        size_t i = 0;
+        while (it != data.end() || i < entries.size()) {
+            if (i == entries.size() || (it != data.end() && it->first <= entries[i].start)) {
+                add({it->first, it->second->end(), 0, it->second});
+                ++it;
+            } else {
+                add(entries[i++]);
+            }
+        }
+        if (!run.empty()) {
+            flush();
+        }
+        data = std::move(merged);
+    }
+
+    template <typename F_removed>
+    void createMissing(T_addr addr, F_removed removed) {
+        assert(!find(addr));
+
+        // Find closest upper and lower segments to the address
+        const Segment* lower = lowerNeighbor(addr);
+        const Segment* upper = upperNeighbor(addr);
+
+        // Create a segment around the requested address as given by the growth policy. If such a new segment
+        // overlaps with the closest segments to the new segment, the new segment will adjusted accordingly (either
+        // truncated or shifted wrt. the requested address). We ensure that the bounds of the new segment is adjusted to
+        // facilitate coalescing when inserted.
+        // The segment spans [first, last]. If the segment would extend below the bottom of the address space, it is
+        // shifted upwards. If it would extend beyond the top of the address space, it is truncated.
+        const SASGrowth growth = m_growth.grow(addr, lower, upper, m_minSegSize);
+        const uint64_t below = std::min<uint64_t>(growth.below, addr);
+        const uint64_t shift = growth.truncateOnly ? 0 : growth.below - below;
+        T_addr first = addr - static_cast<T_addr>(below);
+        T_addr last = saturatingAdd(addr, static_cast<T_addr>(std::min<uint64_t>(growth.above + shift, c_maxAddr)));
+
+        if (lower && reaches(lower->end(), first)) {
+            // lower->end() < addr, so the address following the lower segment is within the address space
+            const T_addr truncatedBytes = lower->end() + 1 - first;
+            first = lower->end() + 1;
+
+            // Add the truncated bytes to the other end of the new segment
+            if (!growth.truncateOnly) {
+                last = saturatingAdd(last, truncatedBytes);
+            }
+        }
+
+        if (upper && upper->start - 1 < last) {
+            // upper->start > addr, so the address preceding the upper segment is within the address space
+            last = upper->start - 1;
+        }
+        Segment seg;
+        seg.start = first;
+        seg.data = SASSegmentData(static_cast<size_t>(last - first) + 1, m_background);
+        insert(std::move(seg), removed);
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        for (const auto& it : data) {
+            f(static_cast<const Segment&>(*it.second));
+        }
+    }
+
+    template <typename F>
+    void forEach(F f) {
+        for (const auto& it : data) {
+            f(*it.second);
+        }
+    }
+
+    template <typename F_pred, typename F_removed>
+    void removeIf(F_pred pred, F_removed removed) {
+        for (auto it = data.begin(); it != data.end();) {
+            if (pred(static_cast<const Segment&>(*it->second))) {
+                removed(it->second);
+                m_pool->release(it->second);
+                it = data.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /**
+     * @brief share
+     * @returns a shared pointer to @p segment, which expires once the segment is removed; see SegmentPool::share.
+     */
+    SegSPtr share(const Segment& segment) const { return m_pool->share(const_cast<Segment*>(&segment)); }
+
+    size_t size() const { return data.size(); }
+
+    /**
+     * @brief setBackground
+     * Sets the value of the bytes of segments created by createMissing.
+     */
+    void setBackground(uint8_t value) { m_background = value; }
+
+    /**
+     * @brief setMaxSegSize
+     * Limits segments to at most @p n bytes, such that coalescing stops at @p n bytes and larger segments are split into
+     * runs of adjacent segments. The cost of coalescing with a segment and the granularity of copy-on-write are thus
+     * bounded by @p n. Existing segments larger than @p n are split without copying their bytes, except for a last part
+     * which is coalesced with a following segment it fits together with. 0 lifts the limit. If the limit is raised or
+     * lifted, adjacent segments which fit within the new limit together are coalesced, as upon insertion.
+     */
+    template <typename F_removed>
+    void setMaxSegSize(size_t n, F_removed removed) {
+        const bool raised = m_maxSegSize != 0 && (n == 0 || n > m_maxSegSize);
+        m_maxSegSize = n;
+        if (raised) {
+            for (auto it = data.begin(); it != data.end() && std::next(it) != data.end();) {
+                it = mergeAdjacent(it, removed);
+            }
+            return;
+        }
+        if (n == 0) {
+            return;
+        }
+        for (auto it = data.begin(); it != data.end();) {
+            Segment& seg = *it->second;
+            ++it;
+            if (seg.data.size() <= n) {
+                continue;
+            }
+            // The first part stays in place, so segment pointers held elsewhere remain valid
+            std::vector<Segment> chunks = splitSegment(std::move(seg));
+            seg = std::move(chunks.front());
+            for (size_t i = 1; i < chunks.size(); i++) {
+                Segment* chunkSeg = m_pool->allocate();
+                *chunkSeg = std::move(chunks[i]);
+                data.emplace_hint(it, chunkSeg->start, chunkSeg);
+            }
+            // The last part may fit together with the following segment
+            if (it != data.end()) {
+                it = mergeAdjacent(std::prev(it), [](const Segment*) {});
+            }
+        }
+    }
+
+    /**
+     * @brief setCoalescing
+     * With SASCoalescing::Deferred, inserted segments are never coalesced with adjacent segments. With
+     * SASCoalescing::DeferShared, segments are not coalesced upon insertion if that would copy bytes shared
+     * copy-on-write, ie. if the larger of the two segments shares its bytes, such as a segment of the initialization SAS
+     * after a reset; coalescing with segments holding private bytes only copies the smaller segment, amortized by the
+     * headroom of the larger one, and is not deferred. Segments overlapping an inserted segment whose coalescing is
+     * deferred are trimmed rather than coalesced with it, unless one contains the other, and adjacent segments are only
+     * coalesced by compact().
+     */
+    void setCoalescing(SASCoalescing mode) { m_coalescing = mode; }
+
+    /**
+     * @brief compact
+     * Coalesces all runs of adjacent segments, within the maximum segment size, in a single pass over the index. A run
+     * is coalesced into its largest segment if that holds at least half of the run, such that only the bytes of the
+     * smaller segments are copied, and into a single new buffer otherwise.
+     */
+    template <typename F_removed>
+    void compact(F_removed removed) {
+        auto it = data.begin();
+        while (it != data.end()) {
+            // Find the run [it, end) of adjacent segments starting at it, and its largest segment
+            auto base = it;
+            auto end = std::next(it);
+            while (end != data.end() && reaches(std::prev(end)->second->end(), end->first) &&
+                   fits(it->first, end->second->end())) {
+                if (end->second->data.size() > base->second->data.size()) {
+                    base = end;
+                }
+                ++end;
+            }
+            if (std::next(it) == end) {
+                it = end;
+                continue;
+            }
+
+            Segment& merged = *base->second;
+            const size_t runSize = static_cast<size_t>(std::prev(end)->second->end() - it->first) + 1;
+            if (merged.data.size() >= runSize / 2) {
+                for (auto m = base; m != it;) {
+                    --m;
+                    merged.data.prepend(m->second->data.data(), m->second->data.size());
+                }
+                for (auto m = std::next(base); m != end; ++m) {
+                    merged.data.append(m->second->data.data(), m->second->data.size());
+                }
+            } else {
+                SASSegmentData bytes(runSize, 0);
+                uint8_t* dst = bytes.mutableData();
+                for (auto m = it; m != end; ++m) {
+                    std::memcpy(dst + (m->first - it->first), m->second->data.data(), m->second->data.size());
+                }
+                merged.data = std::move(bytes);
+            }
+            merged.start = it->first;
+            merged.fromInit = false;
+            merged.dirtyChunks.clear();
+            for (auto m = it; m != end; ++m) {
+                if (m != base) {
+                    removed(m->second);
+                    m_pool->release(m->second);
+                }
+            }
+            it = std::next(data.emplace_hint(data.erase(it, end), merged.start, &merged));
+        }
+        m_pendingMerges = 0;
+    }
+
+    /**
+     * @brief fragmentation
+     * @returns the number of times coalescing was deferred since the last compaction, relative to the number of
+     * segments. Segments removed or overwritten since may have been counted, so this is an upper estimate of the
+     * fraction of segments which compact() would coalesce.
+     */
+    double fragmentation() const { return data.empty() ? 0 : static_cast<double>(m_pendingMerges) / data.size(); }
+
+    void clear() {
+        data = SASData();
+        m_pool = std::make_shared<Pool>();
+        m_pendingMerges = 0;
+    }
+
+    void assignShared(const IntervalStorage& other) {
+        clear();
+        m_pendingMerges = other.m_pendingMerges;
+        for (const auto& it : other.data) {
+            // Segments of other are already sorted and non-overlapping; appending them at the end of the index is
+            // amortized O(1) each.
+            Segment* seg = m_pool->allocate();
+            seg->start = it.second->start;
+            seg->data = it.second->data;
+            data.emplace_hint(data.end(), it.first, seg);
+        }
+    }
+
+private:
+    /**
+     * @brief The BulkEntry struct
+     * A segment taking part in insertBulk. Existing segments have priority 0, and new segments the priority of their
+     * position in the input, starting at 1.
+     */
+    struct BulkEntry {
+        T_addr start;
+        T_addr end;
+        size_t priority;
+        Segment* segment;
+    };
+
+    static bool bulkEntryLess(const BulkEntry& a, const BulkEntry& b) {
+        return a.start < b.start || (a.start == b.start && a.priority < b.priority);
+    }
+
+    /**
+     * @brief sortByStart
+     * Sorts @p entries by start address. The sort is stable, such that entries with equal start addresses remain in
+     * priority order. Large inputs are radix sorted a byte at a time, skipping bytes which are equal for all entries.
+     */
+    static void sortByStart(std::vector<BulkEntry>& entries) {
+        if (entries.size() < 1024) {
+            std::sort(entries.begin(), entries.end(), bulkEntryLess);
+            return;
+        }
+        std::vector<BulkEntry> sorted(entries.size());
+        for (unsigned shift = 0; shift < sizeof(T_addr) * CHAR_BIT; shift += CHAR_BIT) {
+            size_t counts[256] = {};
+            for (const BulkEntry& e : entries) {
+                counts[(e.start >> shift) & 0xFF]++;
+            }
+            if (counts[(entries.front().start >> shift) & 0xFF] == entries.size()) {
+                continue;
+            }
+            size_t offset = 0;
+            for (size_t& count : counts) {
+                const size_t n = count;
+                count = offset;
+                offset += n;
+            }
+            for (const BulkEntry& e : entries) {
+                sorted[counts[(e.start >> shift) & 0xFF]++] = e;
+            }
+            entries.swap(sorted);
+        }
+    }
+
+    /**
+     * @brief reaches
+     * @returns true if a segment ending at @p end overlaps or is adjacent to the address @p addr, ie. if
+     * end + 1 >= addr. The address following @p end is never computed, to avoid overflowing at the top of the address
+     * space.
+     */
+    static inline bool reaches(T_addr end, T_addr addr) { return addr == 0 || end >= addr - 1; }
+
+    /**
+     * @brief saturatingAdd
+     * @returns a + b, saturated at the top of the address space.
+     */
+    static inline T_addr saturatingAdd(T_addr a, T_addr b) { return c_maxAddr - a < b ? c_maxAddr : a + b; }
+
+    /**
+     * @brief lowerNeighbor
+     * @returns the closest segment starting at or below @p addr, or nullptr if no such segment exists. If @p addr is
+     * not contained in any segment, this is the closest segment below the address.
+     */
+    const Segment* lowerNeighbor(T_addr addr) const {
+        auto it = data.upper_bound(addr);
+        return it == data.begin() ? nullptr : std::prev(it)->second;
+    }
+
+    /**
+     * @brief fits
+     * @returns true if segments @p s1 and @p s2 may be coalesced without exceeding the maximum segment size. A segment
+     * which contains the other always fits.
+     */
+    bool fits(const Segment& s1, const Segment& s2) const {
+        return fits(std::min(s1.start, s2.start), std::max(s1.end(), s2.end()));
+    }
+    bool fits(T_addr first, T_addr last) const {
+        // Compare against the span minus one, which cannot overflow for a segment spanning the full address space
+        return m_maxSegSize == 0 || static_cast<uint64_t>(last - first) < m_maxSegSize;
+    }
+
+    /**
+     * @brief coalesces
+     * @returns true if inserting @p segment coalesces it with @p existing, which overlaps or is adjacent to it. A
+     * segment containing the other is always coalesced with it; otherwise, coalescing must not be deferred, and the
+     * result must fit within the maximum segment size.
+     */
+    bool coalesces(const Segment& existing, const Segment& segment) const {
+        return existing.contains(segment) || segment.contains(existing) ||
+               (fits(existing, segment) && !defers(existing, segment));
+    }
+
+    /**
+     * @brief defers
+     * @returns true if coalescing @p s1 and @p s2 is deferred, ie. if all coalescing is deferred, or if shared
+     * coalescing is deferred and would copy the bytes of the larger segment (see coalesce), which are shared
+     * copy-on-write.
+     */
+    bool defers(const Segment& s1, const Segment& s2) const {
+        return m_coalescing == SASCoalescing::Deferred ||
+               (m_coalescing == SASCoalescing::DeferShared && sharesBytes(s1.data.size() > s2.data.size() ? s1 : s2));
+    }
+
+    /**
+     * @brief sharesBytes
+     * @returns true if writing to @p seg would copy its bytes, as they are shared copy-on-write or not yet filled (see
+     * SASSegmentData::deferred). Deferred segment data is not filled by this check.
+     */
+    static bool sharesBytes(const Segment& seg) { return seg.data.isDeferred() || seg.data.isShared(); }
+
+    /**
+     * @brief deferMerge
+     * Counts the adjacent segments @p s1 and @p s2 towards the fragmentation, if compact() would coalesce them.
+     */
+    void deferMerge(const Segment& s1, const Segment& s2) { m_pendingMerges += fits(s1, s2) && defers(s1, s2); }
+
+    /**
+     * @brief trim
+     * Trims @p seg to its @p n bytes at @p offset, sharing its buffer. The segment no longer has the bounds of a segment
+     * of the initialization SAS.
+     */
+    static void trim(Segment& seg, size_t offset, size_t n) {
+        seg.data = seg.data.slice(offset, n);
+        seg.start += static_cast<T_addr>(offset);
+        seg.fromInit = false;
+        seg.dirtyChunks.clear();
+    }
+
+    /**
+     * @brief mergeAdjacent
+     * Coalesces the segment at @p lower into the following segment, if they are adjacent and fit within the maximum
+     * segment size together. If coalescing them is deferred, the merge is only counted.
+     * @returns the position of the following segment.
+     */
+    template <typename F_removed>
+    typename SASData::iterator mergeAdjacent(typename SASData::iterator lower, F_removed removed) {
+        auto upper = std::next(lower);
+        Segment& s1 = *lower->second;
+        Segment& s2 = *upper->second;
+        if (!reaches(s1.end(), s2.start) || !fits(s1, s2)) {
+            return upper;
+        }
+        if (defers(s1, s2)) {
+            m_pendingMerges++;
+            return upper;
+        }
+        coalesce(s1, s2);
+        s2.fromInit = false;
+        s2.dirtyChunks.clear();
+        removed(&s1);
+        m_pool->release(&s1);
+        lower->second = &s2;
+        data.erase(upper);
+        return lower;
+    }
+
+    /**
+     * @brief splitSegment
+     * @returns the run of adjacent segments of at most m_maxSegSize bytes covering @p segment, which views the bytes of
+     * @p segment without copying them.
+     */
+    std::vector<Segment> splitSegment(Segment&& segment) const {
+        std::vector<std::pair<size_t, size_t>> ranges;
+        for (size_t offset = 0; offset < segment.data.size(); offset += m_maxSegSize) {
+            ranges.emplace_back(offset, std::min(m_maxSegSize, segment.data.size() - offset));
+        }
+        std::vector<SASSegmentData> views = std::move(segment.data).split(ranges);
+        std::vector<Segment> chunks(views.size());
+        for (size_t i = 0; i < views.size(); i++) {
+            chunks[i].start = segment.start + static_cast<T_addr>(ranges[i].first);
+            chunks[i].data = std::move(views[i]);
+        }
+        return chunks;
+    }
+
+    /**
+     * @brief coalesce
+     * Coalesce two segments into @p s2, using values of @p s2 for any overlapping addresses between @p s1 and
+     * @p s2. The bytes of the smaller segment are copied into the larger segment, such that growing a large segment
+     * one small segment at a time does not copy the large segment; see SASSegmentData::prepend().
+     */
+    Segment& coalesce(Segment& s1, Segment& s2) {
+        if (s2.contains(s1)) {
+            return s2;
+        }
+
+        if (s1.data.size() > s2.data.size()) {
+            // Extend s1 to cover s2, copy s2 over it, and adopt the result as s2
+            if (s2.start < s1.start) {
+                s1.data.prepend(s2.data.data(), static_cast<size_t>(s1.start - s2.start));
+                s1.start = s2.start;
+            }
+            if (s2.end() > s1.end()) {
+                const size_t upperBytes = static_cast<size_t>(s2.end() - s1.end());
+                s1.data.append(s2.data.end() - upperBytes, upperBytes);
+            }
+            std::memcpy(s1.data.mutableData() + (s2.start - s1.start), s2.data.data(), s2.data.size());
+            s2.start = s1.start;
+            s2.data = std::move(s1.data);
+            return s2;
+        }
+
+        // Coalesce lower
+        if (s1.start < s2.start) {
+            s2.data.prepend(s1.data.data(), static_cast<size_t>(s2.start - s1.start));
+            s2.start = s1.start;
+        }
+
+        // Coalesce upper
+        if (s1.end() > s2.end()) {
+            const size_t upperBytes = static_cast<size_t>(s1.end() - s2.end());
+            s2.data.append(s1.data.end() - upperBytes, upperBytes);
+        }
+
+        return s2;
+    }
+
+    /**
+     * @brief data
+     * Index of the currently active segments in the address space.
+     */
+    SASData data;
+
+    /**
+     * @brief m_pool
+     * Owner of all segments in the index, see share().
+     */
+    std::shared_ptr<Pool> m_pool;
+
+    /**
+     * @brief m_minSegSize
+     * Minimum segment size, in bytes.
+     * When an address which is not contained within any segment is accessed, a new segment is created around the
+     * address. This segment will (assuming no conflicts with adjacent segments, see createMissing) have
+     * m_minSegSize width, centerred around the requested address.
+     */
+    const unsigned m_minSegSize;
+    uint8_t m_background = 0;
+
+    /**
+     * @brief m_maxSegSize
+     * Maximum segment size in bytes, or 0 if segments are unbounded; see setMaxSegSize.
+     */
+    size_t m_maxSegSize = 0;
+
+    /**
+     * @brief m_coalescing
+     * Which merges with adjacent segments are deferred until compact(), see setCoalescing. m_pendingMerges counts the
+     * deferred merges since the last compaction, see fragmentation().
+     */
+    SASCoalescing m_coalescing = SASCoalescing::Eager;
+    size_t m_pendingMerges = 0;
+
+    /**
+     * @brief m_growth
+     * Growth policy determining the bounds of segments created by createMissing.
+     */
+    T_growth m_growth;
+};
+
+/**
+ * @brief The PageTableStorage class
+ * Storage policy backing the address space with fixed-size pages of 2^PageBits bytes, held in a lazily allocated
+ * multi-level radix table. Each level of the table is indexed by LevelBits bits of the page number (the top level by
+ * any remaining bits). Looking up a page is thus a fixed number of array indexes, and pages are never coalesced.
+ * Segments of this storage are always page-aligned pages.
+ */
+template <typename T_addr, unsigned PageBits = 12, unsigned LevelBits = 10>
+class PageTableStorage {
+public:
+    static_assert(std::is_unsigned<T_addr>::value, "Address type must be an unsigned integer type.");
+    static_assert(sizeof(T_addr) * CHAR_BIT > PageBits, "Pages must be smaller than the address space.");
+    static_assert(LevelBits > 0, "LevelBits must be positive.");
+
+    using Segment = SASSegment<T_addr>;
+    using SegSPtr = std::shared_ptr<Segment>;
+    using Pool = SegmentPool<Segment>;
+
+    constexpr static size_t c_pageSize = size_t(1) << PageBits;
+    constexpr static unsigned c_pageNumberBits = sizeof(T_addr) * CHAR_BIT - PageBits;
+    constexpr static unsigned c_levels = (c_pageNumberBits + LevelBits - 1) / LevelBits;
+    constexpr static unsigned c_topLevelBits = c_pageNumberBits - (c_levels - 1) * LevelBits;
+    constexpr static uint64_t c_maxPageNumber = std::numeric_limits<T_addr>::max() >> PageBits;
+
+    /**
+     * @param minSegSize: unused, pages are always of c_pageSize bytes.
+     */
+    PageTableStorage(const unsigned /*minSegSize*/) { clear(); }
+    PageTableStorage(PageTableStorage&&) = default;
+    PageTableStorage(const PageTableStorage&) = delete;
+    PageTableStorage& operator=(const PageTableStorage&) = delete;
+
+    Segment* find(T_addr address) const {
+        const uint64_t pn = address >> PageBits;
+        const Node* node = m_root.get();
+        for (unsigned level = 0; level + 1 < c_levels; level++) {
+            node = node->children[index(pn, level)].get();
+            if (!node) {
+                return nullptr;
+            }
+        }
+        return node->pages[index(pn, c_levels - 1)];
+    }
+
+    /**
+     * @brief upperNeighbor
+     * @returns the closest page starting above @p addr and at or below @p last, or nullptr if no such page exists.
+     * Unallocated subtables are skipped in their entirety, and the search stops at @p last.
+     */
+    const Segment* upperNeighbor(T_addr addr, T_addr last = std::numeric_limits<T_addr>::max()) const {
+        const uint64_t pn = addr >> PageBits;
+        return pn == c_maxPageNumber ? nullptr : firstPageFrom(*m_root, 0, pn + 1, last >> PageBits);
+    }
+
+    /**
+     * @brief insert
+     * Copies the bytes of @p segment into the pages which it overlaps, allocating any missing pages. Pages are only
+     * removed through removeIf. If @p segment is exactly a single page which is not yet allocated, it is adopted as
+     * that page without copying its bytes.
+     */
+    template <typename F_removed>
+    void insert(Segment&& segment, F_removed) {
+        if (segment.data.size() == c_pageSize && (segment.start & (c_pageSize - 1)) == 0) {
+            Segment*& page = pageSlot(segment.start >> PageBits);
+            if (!page) {
+                page = m_pool->allocate();
+                *page = std::move(segment);
+                m_pageCount++;
+                return;
+            }
+        }
+
+        const uint8_t* src = segment.data.data();
+        size_t n = segment.data.size();
+        T_addr address = segment.start;
+        while (n > 0) {
+            Segment& page = getOrCreatePage(address >> PageBits);
+            const size_t offset = address - page.start;
+            const size_t chunk = std::min(n, c_pageSize - offset);
+            std::memcpy(page.data.mutableData() + offset, src, chunk);
+            src += chunk;
+            address += chunk;
+            n -= chunk;
+        }
+    }
+
+    /**
+     * @brief insertBulk
+     * Inserts @p segments one at a time, in order. Pages are never coalesced, so there is no index to rebuild.
+     */
+    template <typename F_removed>
+    void insertBulk(std::vector<Segment>&& segments, F_removed removed) {
+        for (Segment& segment : segments) {
+            insert(std::move(segment), removed);
+        }
+    }
+
+    /**
+     * @brief insertDisjoint
+     * Pages are never coalesced, so this is insert() of a page which is not yet allocated.
+     */
+    void insertDisjoint(Segment&& segment) {
+        insert(std::move(segment), [](const Segment*) {});
+    }
+
+    template <typename F_removed>
+    void createMissing(T_addr addr, F_removed) {
+        getOrCreatePage(addr >> PageBits);
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        forEachPage<const Node, const Segment>(*m_root, 0, f);
+    }
+
+    template <typename F>
+    void forEach(F f) {
+        forEachPage<Node, Segment>(*m_root, 0, f);
+    }
+
+    template <typename F_pred, typename F_removed>
+    void removeIf(F_pred pred, F_removed removed) {
+        removePagesIf(*m_root, 0, pred, removed);
+    }
+
+    /**
+     * @brief share
+     * @returns a shared pointer to @p segment, which expires once the page is removed; see SegmentPool::share.
+     */
+    SegSPtr share(const Segment& segment) const { return m_pool->share(const_cast<Segment*>(&segment)); }
+
+    size_t size() const { return m_pageCount; }
+
+    /**
+     * @brief setBackground
+     * Sets the value of the bytes of newly allocated pages which are not written upon allocation.
+     */
+    void setBackground(uint8_t value) { m_background = value; }
+
+    /**
+     * @brief setMaxSegSize
+     * Pages are never coalesced and never exceed c_pageSize bytes, so there is nothing to limit.
+     */
+    template <typename F_removed>
+    void setMaxSegSize(size_t, F_removed) {}
+
+    /**
+     * @brief setCoalescing, compact, fragmentation
+     * Pages are never coalesced, so there is nothing to defer or compact.
+     */
+    void setCoalescing(SASCoalescing) {}
+    template <typename F_removed>
+    void compact(F_removed) {}
+    double fragmentation() const { return 0; }
+
+    void clear() {
+        m_root = std::make_unique<Node>(0);
+        m_pool = std::make_shared<Pool>();
+        m_pageCount = 0;
+    }
+
+    void assignShared(const PageTableStorage& other) {
+        clear();
+        copyShared(*other.m_root, *m_root, 0);
+        m_pageCount = other.m_pageCount;
+    }
+
+private:
+    /**
+     * @brief The Node struct
+     * A table of the radix tree. Tables at the last level hold pages, all other tables hold subtables.
+     */
+    struct Node {
+        Node(unsigned level) {
+            if (level + 1 < c_levels) {
+                children.resize(fanout(level));
+            } else {
+                pages.resize(fanout(level));
+            }
+        }
+        std::vector<std::unique_ptr<Node>> children;
+        std::vector<Segment*> pages;
+    };
+
+    static constexpr size_t fanout(unsigned level) {
+        return size_t(1) << (level == 0 ? c_topLevelBits : LevelBits);
+    }
+
+    /**
+     * @brief shift
+     * @returns the position of the page number bits indexing the table at @p level.
+     */
+    static constexpr unsigned shift(unsigned level) { return (c_levels - 1 - level) * LevelBits; }
+    static constexpr size_t index(uint64_t pn, unsigned level) { return (pn >> shift(level)) & (fanout(level) - 1); }
+
+    /**
+     * @brief pageSlot
+     * @returns the page table entry of page number @p pn, allocating any missing tables on the way.
+     */
+    Segment*& pageSlot(uint64_t pn) {
+        Node* node = m_root.get();
+        for (unsigned level = 0; level + 1 < c_levels; level++) {
+            auto& child = node->children[index(pn, level)];
+            if (!child) {
+                child = std::make_unique<Node>(level + 1);
+            }
+            node = child.get();
+        }
+        return node->pages[index(pn, c_levels - 1)];
+    }
+
+    Segment& getOrCreatePage(uint64_t pn) {
+        Segment*& page = pageSlot(pn);
+        if (!page) {
+            page = m_pool->allocate();
+            page->start = static_cast<T_addr>(pn << PageBits);
+            page->data = SASSegmentData(c_pageSize, m_background);
+            m_pageCount++;
+        }
+        return *page;
+    }
+
+    /**
+     * @brief firstPageFrom
+     * @returns the first allocated page within the table @p node at @p level, having a page number of at least @p pn
+     * and at most @p last. @p node must be the table containing page number @p pn at @p level.
+     */
+    const Segment* firstPageFrom(const Node& node, unsigned level, uint64_t pn, uint64_t last) const {
+        const uint64_t entryPages = uint64_t(1) << shift(level);
+        for (size_t i = index(pn, level); i < fanout(level) && pn <= last; i++) {
+            if (level + 1 == c_levels) {
+                if (node.pages[i]) {
+                    return node.pages[i];
+                }
+            } else if (node.children[i]) {
+                if (const Segment* page = firstPageFrom(*node.children[i], level + 1, pn, last)) {
+                    return page;
+                }
+            }
+            // Continue at the first page of the next entry
+            pn = (pn | (entryPages - 1)) + 1;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief copyShared
+     * Copies the subtables and pages of @p from into @p to, sharing the bytes of all pages.
+     */
+    void copyShared(const Node& from, Node& to, unsigned level) {
+        if (level + 1 == c_levels) {
+            for (size_t i = 0; i < from.pages.size(); i++) {
+                if (from.pages[i]) {
+                    to.pages[i] = m_pool->allocate();
+                    to.pages[i]->start = from.pages[i]->start;
+                    to.pages[i]->data = from.pages[i]->data;
+                }
+            }
+        } else {
+            for (size_t i = 0; i < from.children.size(); i++) {
+                if (from.children[i]) {
+                    to.children[i] = std::make_unique<Node>(level + 1);
+                    copyShared(*from.children[i], *to.children[i], level + 1);
+                }
+            }
+        }
+    }
+
+    template <typename T_node, typename T_segment, typename F>
+    static void forEachPage(T_node& node, unsigned level, F& f) {
+        if (level + 1 == c_levels) {
+            for (T_segment* page : node.pages) {
+                if (page) {
+                    f(*page);
+                }
+            }
+        } else {
+            for (const auto& child : node.children) {
+                if (child) {
+                    forEachPage<T_node, T_segment>(*child, level + 1, f);
+                }
+            }
+        }
+    }
+
+    template <typename F_pred, typename F_removed>
+    void removePagesIf(Node& node, unsigned level, F_pred& pred, F_removed& removed) {
+        if (level + 1 == c_levels) {
+            for (Segment*& page : node.pages) {
+                if (page && pred(static_cast<const Segment&>(*page))) {
+                    removed(page);
+                    m_pool->release(page);
+                    page = nullptr;
+                    m_pageCount--;
+                }
+            }
+        } else {
+            for (const auto& child : node.children) {
+                if (child) {
+                    removePagesIf(*child, level + 1, pred, removed);
+                }
+            }
+        }
+    }
+
+    std::unique_ptr<Node> m_root;
+    std::shared_ptr<Pool> m_pool;
+    size_t m_pageCount = 0;
+    uint8_t m_background = 0;
+};
+
+/**
+ * Journal policies
+ * The journal policy, given as the third template parameter of SparseAddressSpace, records the bytes overwritten by
+ * writes such that they may later be undone. A journal policy provides:
+ * - static constexpr bool enabled: whether writes are recorded. If false, the address space does not call into the
+ *   journal at all, and the remaining members need not exist.
+ * - void record(T_addr address, size_t n, F_read read): records a write of @p n bytes at @p address. @p read(address,
+ *   dst, n) copies the current bytes of a part of the span into @p dst.
+ * - void rewindTo(uint64_t step, F_undo undo): calls @p undo(address, bytes, n) for all writes recorded after @p step,
+ *   newest first.
+ * - void clear(): drops all recorded writes.
+ */
+
+/**
+ * @brief The NoJournal struct
+ * Journal policy which records nothing. Writes are not instrumented in any way.
+ */
+struct NoJournal {
+    static constexpr bool enabled = false;
+};
+
+/**
+ * @brief The UndoJournal class
+ * Journal policy recording the overwritten bytes of each write in a fixed-capacity ring buffer. Each entry is tagged
+ * with the current step, as set by the user through setStep(), and is laid out as
+ *   [step (8 bytes)][size (8 bytes)][address][old bytes][size (8 bytes)]
+ * The size is repeated at the end of the entry, such that the ring may be traversed from either end. When the ring is
+ * full, the oldest entries are evicted, which limits how far back the address space may be rewound; see horizon().
+ */
+template <typename T_addr>
+class UndoJournal {
+public:
+    static constexpr bool enabled = true;
+
+    explicit UndoJournal(size_t capacity = size_t(1) << 20) : m_capacity(capacity) {}
+
+    /**
+     * @brief setStep
+     * Sets the step which subsequent writes are tagged with. Steps must be non-decreasing between rewinds.
+     */
+    void setStep(uint64_t step) { m_step = step; }
+    uint64_t step() const { return m_step; }
+
+    /**
+     * @brief setCapacity
+     * Sets the size of the ring buffer in bytes, and drops all recorded writes. A capacity of 0 disables recording.
+     */
+    void setCapacity(size_t capacity) {
+        m_capacity = capacity;
+        m_ring = std::vector<uint8_t>();
+        clear();
+    }
+    size_t capacity() const { return m_capacity; }
+
+    /**
+     * @brief horizon
+     * @returns the earliest step which may be rewound to. Steps before the horizon have been evicted from the ring.
+     */
+    uint64_t horizon() const { return m_horizon; }
+
+    /**
+     * @brief entries
+     * @returns the number of writes currently recorded.
+     */
+    size_t entries() const { return m_entries; }
+
+    template <typename F_read>
+    void record(T_addr address, size_t n, F_read read) {
+        if (m_capacity == 0) {
+            return;
+        }
+        const size_t size = c_headerSize + n + sizeof(uint64_t);
+        if (size > m_capacity) {
+            // The write can never be undone; nothing before the current step can be rewound to
+            clear();
+            return;
+        }
+        if (m_ring.empty()) {
+            m_ring.resize(m_capacity);
+        }
+        while (m_capacity - m_used < size) {
+            evictOldest();
+        }
+
+        const size_t tail = wrap(m_head + m_used);
+        const uint64_t n64 = n;
+        put(tail, &m_step, sizeof(m_step));
+        put(tail + 8, &n64, sizeof(n64));
+        put(tail + 16, &address, sizeof(address));
+
+        // The old bytes are read directly into the ring, in up to two parts if the ring wraps
+        const size_t payload = wrap(tail + c_headerSize);
+        const size_t first = std::min(n, m_capacity - payload);
+        read(address, m_ring.data() + payload, first);
+        if (first < n) {
+            read(static_cast<T_addr>(address + first), m_ring.data(), n - first);
+        }
+
+        put(payload + n, &n64, sizeof(n64));
+        m_used += size;
+        m_entries++;
+    }
+
+    template <typename F_undo>
+    void rewindTo(uint64_t step, F_undo undo) {
+        if (step < m_horizon) {
+            throw std::runtime_error("Trying to rewind beyond the oldest recorded step");
+        }
+        while (m_entries > 0) {
+            const size_t tail = wrap(m_head + m_used);
+            uint64_t n;
+            get(tail + m_capacity - sizeof(n), &n, sizeof(n));
+            const size_t size = c_headerSize + n + sizeof(uint64_t);
+            const size_t entry = wrap(tail + m_capacity - size);
+
+            uint64_t entryStep;
+            T_addr address;
+            get(entry, &entryStep, sizeof(entryStep));
+            if (entryStep <= step) {
+                break;
+            }
+            get(entry + 16, &address, sizeof(address));
+
+            const size_t payload = wrap(entry + c_headerSize);
+            if (payload + n <= m_capacity) {
+                undo(address, m_ring.data() + payload, static_cast<size_t>(n));
+            } else {
+                m_scratch.resize(n);
+                get(payload, m_scratch.data(), n);
+                undo(address, m_scratch.data(), static_cast<size_t>(n));
+            }
+            m_used -= size;
+            m_entries--;
+        }
+        m_step = step;
+    }
+
+    /**
+     * @brief clear
+     * Drops all recorded writes. The current step becomes the horizon.
+     */
+    void clear() {
+        m_head = 0;
+        m_used = 0;
+        m_entries = 0;
+        m_horizon = m_step;
+    }
+
+private:
+    constexpr static size_t c_headerSize = 16 + sizeof(T_addr);
+
+    size_t wrap(size_t pos) const { return pos >= m_capacity ? pos - m_capacity : pos; }
+
+    void put(size_t pos, const void* src, size_t n) {
+        pos = wrap(pos);
+        const size_t first = std::min(n, m_capacity - pos);
+        std::memcpy(m_ring.data() + pos, src, first);
+        std::memcpy(m_ring.data(), static_cast<const uint8_t*>(src) + first, n - first);
+    }
+
+    void get(size_t pos, void* dst, size_t n) const {
+        pos = wrap(pos);
+        const size_t first = std::min(n, m_capacity - pos);
+        std::memcpy(dst, m_ring.data() + pos, first);
+        std::memcpy(static_cast<uint8_t*>(dst) + first, m_ring.data(), n - first);
+    }
+
+    void evictOldest() {
+        uint64_t step, n;
+        get(m_head, &step, sizeof(step));
+        get(m_head + 8, &n, sizeof(n));
+        const size_t size = c_headerSize + n + sizeof(uint64_t);
+        m_head = wrap(m_head + size);
+        m_used -= size;
+        m_entries--;
+        m_horizon = std::max(m_horizon, step);
+    }
+
+    std::vector<uint8_t> m_ring;
+    std::vector<uint8_t> m_scratch;
+    size_t m_capacity;
+    size_t m_head = 0;
+    size_t m_used = 0;
+    size_t m_entries = 0;
+    uint64_t m_step = 0;
+    uint64_t m_horizon = 0;
+};
+
+/**
+ * @brief The SASReadMode enum
+ * How reads of unmapped addresses are performed, see SparseAddressSpace::setReadMode:
+ * - Materialize: a segment is created around the address, such that subsequent accesses to neighboring addresses hit
+ *   the same segment.
+ * - Background: the background value is returned, and no segment is created. Segments are only created by writes.
+ */
+enum class SASReadMode { Materialize, Background };
+
+/**
+ * @brief The SASFileFormat struct
+ * Layout of the snapshot files written by SparseAddressSpace::save(). All fields are little-endian.
+ *   header:        magic "SASSNAP\0" (8 bytes), version (4), size of an address in bytes (4), segment count (8)
+ *   segment table: for each segment, sorted by start address: start (8), size (8), file offset of the payload (8)
+ *   payloads:      the bytes of each segment, each starting at a multiple of c_payloadAlignment
+ * Payloads are page aligned such that a file may be mapped into memory, and its payloads used as segments directly.
+ *
+ * Compressed snapshot files (version 2) split the bytes of each segment into chunks of c_chunkSize bytes, which are
+ * compressed independently of each other with Lz4Codec:
+ *   header:        as above, followed by the chunk size (8)
+ *   segment table: as above, followed by the size of the payload in the file (8)
+ *   payloads:      the stored size of each chunk of the segment (4 each), followed by the stored chunks. Chunks which
+ *                  do not compress are stored as is, which is indicated by a stored size equal to the chunk size.
+ * Chunks are compressed and decompressed in parallel.
+ */
+struct SASFileFormat {
+    constexpr static char c_magic[8] = {'S', 'A', 'S', 'S', 'N', 'A', 'P', '\0'};
+    constexpr static uint32_t c_version = 1;
+    constexpr static size_t c_headerSize = 24;
+    constexpr static size_t c_entrySize = 24;
+    constexpr static uint64_t c_payloadAlignment = 4096;
+
+    constexpr static uint32_t c_compressedVersion = 2;
+    constexpr static size_t c_compressedHeaderSize = 32;
+    constexpr static size_t c_compressedEntrySize = 32;
+    constexpr static size_t c_chunkSize = 64 << 10;
+
+    /**
+     * @brief c_parallelChunks
+     * Minimum number of chunks of a single segment for the segment to be decompressed in parallel.
+     */
+    constexpr static size_t c_parallelChunks = 16;
+
+    static void put(uint8_t* dst, uint64_t value, unsigned n) {
+        for (unsigned i = 0; i < n; i++) {
+            dst[i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    }
+
+    static uint64_t get(const uint8_t* src, unsigned n) {
+        uint64_t value = 0;
+        for (unsigned i = 0; i < n; i++) {
+            value |= static_cast<uint64_t>(src[i]) << (i * 8);
+        }
+        return value;
+    }
+
+    /**
+     * @brief compressChunk
+     * @returns the stored form of the @p n bytes at @p src.
+     */
+    static std::vector<uint8_t> compressChunk(const uint8_t* src, size_t n) {
+        std::vector<uint8_t> chunk(Lz4Codec::compressBound(n));
+        const size_t size = Lz4Codec::compress(src, n, chunk.data());
+        if (size >= n) {
+            chunk.assign(src, src + n);
+        } else {
+            chunk.resize(size);
+        }
+        return chunk;
+    }
+
+    /**
+     * @brief validChunks
+     * @returns true if the chunk sizes of the compressed @p payload of @p stored bytes, of a segment of @p size bytes,
+     * add up to the size of the payload, and no chunk is stored in more bytes than its uncompressed size.
+     */
+    static bool validChunks(const uint8_t* payload, uint64_t size, uint64_t stored, uint64_t chunkSize) {
+        const uint64_t nChunks = size / chunkSize + (size % chunkSize != 0);
+        if (nChunks > stored / 4) {
+            return false;
+        }
+        uint64_t total = nChunks * 4;
+        for (uint64_t c = 0; c < nChunks; c++) {
+            const uint64_t chunk = get(payload + c * 4, 4);
+            if (chunk == 0 || chunk > std::min(chunkSize, size - c * chunkSize)) {
+                return false;
+            }
+            total += chunk;
+        }
+        return total == stored;
+    }
+
+    /**
+     * @brief decompressSegment
+     * Decompresses the compressed payload at @p payload of a segment of @p size bytes into @p dst. The chunk sizes of
+     * the payload must have been validated.
+     */
+    static void decompressSegment(const uint8_t* payload, size_t size, size_t chunkSize, uint8_t* dst) {
+        const size_t nChunks = (size + chunkSize - 1) / chunkSize;
+        std::vector<const uint8_t*> chunks(nChunks);
+        const uint8_t* p = payload + nChunks * 4;
+        for (size_t c = 0; c < nChunks; c++) {
+            chunks[c] = p;
+            p += get(payload + c * 4, 4);
+        }
+        auto decompress = [&](size_t c) {
+            const size_t n = std::min(chunkSize, size - c * chunkSize);
+            const size_t stored = static_cast<size_t>(get(payload + c * 4, 4));
+            if (stored == n) {
+                std::memcpy(dst + c * chunkSize, chunks[c], n);
+            } else {
+                Lz4Codec::decompress(chunks[c], stored, dst + c * chunkSize, n);
+            }
+        };
+        if (nChunks >= c_parallelChunks) {
+            parallelFor(nChunks, decompress);
+        } else {
+            for (size_t c = 0; c < nChunks; c++) {
+                decompress(c);
+            }
+        }
+    }
+
+    /**
+     * @brief parallelFor
+     * Calls @p f(i) for each i in [0, n), distributed over all hardware threads. The first exception thrown by @p f is
+     * rethrown once all threads have finished.
+     */
+    template <typename F>
+    static void parallelFor(size_t n, F f) {
+        const size_t nThreads = std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+        std::atomic<size_t> next(0);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto work = [&] {
+            try {
+                for (size_t i; (i = next++) < n;) {
+                    f(i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = n;
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < nThreads; t++) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+template <typename T_addr, typename T_storage = IntervalStorage<T_addr>, typename T_journal = NoJournal>
+class SparseAddressSpace {
+public:
+    static_assert(std::is_unsigned<T_addr>::value, "Address type must be an unsigned integer type.");
+    static_assert(std::is_same<typename T_storage::Segment, SASSegment<T_addr>>::value,
+                  "Storage policy must use the address type of the address space.");
+    constexpr static T_addr c_maxAddr = std::numeric_limits<T_addr>::max();
+    /** @brief c_hostLittleEndian
+     * Values are stored in little-endian byte order. On little-endian hosts, values may thus be loaded and stored
+     * directly from/to segment memory.
+     */
+    constexpr static bool c_hostLittleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+    using Segment = SASSegment<T_addr>;
+    using SegSPtr = std::shared_ptr<Segment>;
+    using SegWPtr = std::weak_ptr<Segment>;
+    using SAS = SparseAddressSpace<T_addr, T_storage, T_journal>;
+    /** @brief Snapshot
+     * Immutable copy of the segments of an address space, see snapshot(). The bytes of the segments are shared
+     * copy-on-write with the address space and any other snapshots.
+     */
+    using Snapshot = std::shared_ptr<const T_storage>;
+
+    /**
+     * @brief The TLBStats struct
+     * Hit/miss counters of the segment lookup cache, see m_tlb.
+     */
+    struct TLBStats {
+        size_t hits = 0;
+        size_t misses = 0;
+        double hitRate() const { return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses); }
+    };
+
+    /**
+     * @param minSegSize: minimum size of segments created upon accessing unmapped addresses, see
+     * IntervalStorage::m_minSegSize
+     * @param tlbEntries: number of entries in the segment lookup cache, see m_tlb. Must be a power of two.
+     */
+    SparseAddressSpace(const unsigned minSegSize = 5, const unsigned tlbEntries = 64)
+        : m_storage(minSegSize), m_tlb(tlbEntries), m_tlbMask(tlbEntries - 1), m_minSegSize(minSegSize) {
+        assert(tlbEntries > 0 && (tlbEntries & m_tlbMask) == 0 && "tlbEntries must be a power of two");
+    }
+    SparseAddressSpace(SparseAddressSpace&&) = default;
+
+    void writeByte(T_addr byteAddress, uint8_t value) {
+        Segment& segment = segmentForAddress(byteAddress);
+
+        // Perform write
+        const size_t wridx = byteAddress - segment.start;
+        assert(wridx < segment.data.size());
+        journal(byteAddress, segment, wridx, 1);
+        segment.data.mutableData()[wridx] = value;
+        markDirty(segment, wridx, 1);
+    }
+
+    template <typename T_v>
+    void writeValue(T_addr byteAddress, T_v value, size_t nbytes) {
+        if (nbytes > sizeof(value)) {
+            throw std::runtime_error("Trying to write more bytes than what is contained in @p value");
+        }
+
+        // Fast path: a single unaligned store if the value fits within the segment containing the first byte
+        Segment& segment = segmentForAddress(byteAddress);
+        const size_t wridx = byteAddress - segment.start;
+        if (c_hostLittleEndian && segment.data.size() - wridx >= nbytes) {
+            journal(byteAddress, segment, wridx, nbytes);
+            std::memcpy(segment.data.mutableData() + wridx, &value, nbytes);
+            markDirty(segment, wridx, nbytes);
+            return;
+        }
+
+        // The value straddles a segment boundary. Each byte is journaled individually.
+        for (unsigned i = 0; i < nbytes; i++) {
+            writeByte(byteAddress++, value);
+            value >>= CHAR_BIT;
+        }
+    }
+
+    template <typename T_v>
+    void writeValue(T_addr byteAddress, T_v value) {
+        writeValue(byteAddress, value, sizeof(T_v));
+    }
+
+    uint8_t readByte(T_addr address) const { return readByte(address, m_readMode); }
+
+    /**
+     * @brief readByte
+     * Reads the byte at @p address, using @p mode rather than the read mode of the address space.
+     */
+    uint8_t readByte(T_addr address, SASReadMode mode) const {
+        const Segment* segment = mode == SASReadMode::Materialize ? &segmentForAddress(address) : lookup(address);
+        if (!segment) {
+            return m_background;
+        }
+
+        // Perform read
+        const size_t rdidx = address - segment->start;
+        assert(rdidx < segment->data.size());
+        return segment->data[rdidx];
+    }
+
+    template <typename T_v>
+    T_v readValue(T_addr address) const {
+        return readValue<T_v>(address, m_readMode);
+    }
+
+    /**
+     * @brief readValue
+     * Reads the value at @p address, using @p mode rather than the read mode of the address space.
+     */
+    template <typename T_v>
+    T_v readValue(T_addr address, SASReadMode mode) const {
+        T_v value = 0;
+
+        // Fast path: a single unaligned load if the value lies within the segment containing the first byte
+        const Segment* segment = mode == SASReadMode::Materialize ? &segmentForAddress(address) : lookup(address);
+        if (segment) {
+            const size_t rdidx = address - segment->start;
+            if (c_hostLittleEndian && segment->data.size() - rdidx >= sizeof(T_v)) {
+                std::memcpy(&value, segment->data.data() + rdidx, sizeof(T_v));
+                return value;
+            }
+        }
+
+        // The value straddles a segment boundary, or starts at an unmapped address. Without materializing, gaps are
+        // filled in as a whole by readBytes.
+        if (mode == SASReadMode::Background && address <= c_maxAddr - (sizeof(T_v) - 1)) {
+            uint8_t bytes[sizeof(T_v)];
+            readBytes(address, bytes, sizeof(T_v));
+            for (unsigned i = 0; i < sizeof(T_v); i++)
+                value |= static_cast<T_v>(bytes[i]) << (i * CHAR_BIT);
+            return value;
+        }
+        for (unsigned i = 0; i < sizeof(T_v); i++)
+            value |= static_cast<T_v>(readByte(address++, mode)) << (i * CHAR_BIT);
+
+        return value;
+    }
+
+    /**
+     * @brief setReadMode
+     * Sets how readByte and readValue treat unmapped addresses; see SASReadMode. The default is
+     * SASReadMode::Materialize.
+     */
+    void setReadMode(SASReadMode mode) { m_readMode = mode; }
+    SASReadMode readMode() const { return m_readMode; }
+
+    /**
+     * @brief setBackgroundValue
+     * Sets the value of unmapped bytes, as returned by reads which do not create segments, and as initially held by the
+     * bytes of segments created upon accessing unmapped addresses. The default is 0. The initialization SAS, if any,
+     * uses the same background value.
+     */
+    void setBackgroundValue(uint8_t value) {
+        m_background = value;
+        m_storage.setBackground(value);
+        if (m_initData) {
+            m_initData->setBackgroundValue(value);
+        }
+    }
+    uint8_t backgroundValue() const { return m_background; }
+
+    /**
+     * @brief setMaxSegmentSize
+     * Limits segments to at most @p n bytes; 0 (the default) lifts the limit. Coalescing stops at the limit, and larger
+     * segments, including existing ones, are split into runs of adjacent segments. This bounds the bytes copied when
+     * coalescing with a segment, and the bytes copied upon the first write to a segment shared copy-on-write, at the
+     * cost of more segments. Raising or lifting the limit coalesces adjacent segments which fit within it together.
+     * Only segments of IntervalStorage are limited, as pages are already fixed-size. The initialization SAS, if any, uses
+     * the same limit.
+     */
+    void setMaxSegmentSize(size_t n) {
+        m_maxSegSize = n;
+        m_storage.setMaxSegSize(n, [&](const Segment* removed) { invalidateTLB(removed); });
+        if (m_initData) {
+            // Segments created by the last reset no longer have the bounds of the reshaped initialization segments
+            m_initData->setMaxSegmentSize(n);
+            m_fullResetPending = true;
+        }
+    }
+    size_t maxSegmentSize() const { return m_maxSegSize; }
+
+    /**
+     * @brief setCoalescing
+     * Sets when segments are coalesced with adjacent segments; see SASCoalescing. The default is SASCoalescing::Eager.
+     * With SASCoalescing::Deferred, segments are inserted and created without coalescing them with adjacent segments.
+     * With SASCoalescing::DeferShared, segments are only not coalesced when that would copy the bytes of a segment
+     * shared copy-on-write, such as a segment of the initialization SAS after a reset or a segment of a snapshot, such
+     * that writes next to large shared segments do not copy them; segments with private bytes are coalesced as with
+     * SASCoalescing::Eager, which only copies the smaller segment. In both modes, segments whose coalescing is deferred
+     * are left adjacent until fragmentation() exceeds @p compactionThreshold, or until compact() if
+     * @p compactionThreshold is 0, while the lookup cache keeps accesses to the additional segments cheap. Switching
+     * back to SASCoalescing::Eager compacts the address space. Only IntervalStorage coalesces segments.
+     */
+    void setCoalescing(SASCoalescing mode, double compactionThreshold = 0.5) {
+        m_coalescing = mode;
+        m_compactionThreshold = compactionThreshold;
+        m_storage.setCoalescing(mode);
+        if (mode == SASCoalescing::Eager) {
+            compact();
+        }
+    }
+    SASCoalescing coalescing() const { return m_coalescing; }
+
+    /**
+     * @brief compact
+     * Coalesces all adjacent segments in a single pass over the segments, copying only the bytes of the smaller segment
+     * of each run of adjacent segments.
+     */
+    void compact() {
+        m_storage.compact([&](const Segment* removed) { invalidateTLB(removed); });
+    }
+
+    /**
+     * @brief fragmentation
+     * @returns an estimate of the fraction of segments which compact() would coalesce, see setCoalescing.
+     */
+    double fragmentation() const { return m_storage.fragmentation(); }
+
+    /**
+     * @brief readBytes
+     * Reads @p n bytes starting at @p address into @p dst. The read is split at segment boundaries, with a single
+     * memcpy per segment. Unmapped bytes read as the background value, and no segments are created for them,
+     * regardless of the read mode.
+     */
+    void readBytes(T_addr address, uint8_t* dst, size_t n) const {
+        checkSpan(address, n);
+
+        while (n > 0) {
+            size_t chunk;
+            if (const Segment* seg = m_storage.find(address)) {
+                const size_t offset = address - seg->start;
+                chunk = std::min(n, seg->data.size() - offset);
+                std::memcpy(dst, seg->data.data() + offset, chunk);
+            } else {
+                // Gap up until the next segment, or the end of the span
+                const Segment* upper = m_storage.upperNeighbor(address, static_cast<T_addr>(address + (n - 1)));
+                chunk = upper ? std::min<size_t>(n, upper->start - address) : n;
+                std::memset(dst, m_background, chunk);
+            }
+            dst += chunk;
+            address += chunk;
+            n -= chunk;
+        }
+    }
+
+    /**
+     * @brief writeBytes
+     * Writes @p n bytes from @p src starting at @p address. If the span lies within a single segment, this is a single
+     * memcpy. Otherwise, the span is inserted as a single segment covering any gaps, which is coalesced with the
+     * segments it overlaps.
+     */
+    void writeBytes(T_addr address, const uint8_t* src, size_t n) {
+        checkSpan(address, n);
+        if (n == 0) {
+            return;
+        }
 
-#ifdef USE_SAS_NAMESPACE
-namespace sas {
-#endif
+        Segment* seg = m_storage.find(address);
+        if (seg && seg->end() >= address + static_cast<T_addr>(n - 1)) {
+            journal(address, *seg, address - seg->start, n);
+            std::memcpy(seg->data.mutableData() + (address - seg->start), src, n);
+            markDirty(*seg, address - seg->start, n);
+        } else {
+            insertSegment(address, src, n);
+        }
+    }
 
-template <typename T_addr>
-class SparseAddressSpace {
-public:
-    /** @brief LargeInt
-     * Used in cases when checking and adjusting under/overflow within the T_addr range.
+    /**
+     * @brief journal
+     * @returns the journal recording the writes to the address space, see UndoJournal.
      */
-    using LargeInt = long long;
-    static_assert(sizeof(LargeInt) > sizeof(T_addr),
-                  "Address type must be smaller than the internal large integer value.");
-    constexpr static LargeInt c_maxAddr = std::numeric_limits<T_addr>::max();
+    T_journal& journal() { return m_journal; }
+    const T_journal& journal() const { return m_journal; }
 
-    struct Segment;
-    using SegSPtr = std::shared_ptr<Segment>;
-    using SegWPtr = std::weak_ptr<Segment>;
-    using T_interval = Interval<LargeInt, SegSPtr>;
-    using IntervalVector = std::vector<T_interval>;
-    using Range = std::pair<LargeInt, LargeInt>;
-    using SASData = IntervalTree<LargeInt, SegSPtr>;
-    using SAS = SparseAddressSpace<T_addr>;
+    /**
+     * @brief rewindTo
+     * Undoes all writes recorded after @p step, newest first, restoring the contents of the address space as of the end
+     * of @p step. Segments created by the undone writes are not removed, but read as they did before the writes.
+     * Throws if @p step lies before the horizon of the journal.
+     */
+    void rewindTo(uint64_t step) {
+        static_assert(T_journal::enabled, "rewindTo requires a journal policy which records writes");
+        m_journal.rewindTo(step, [&](T_addr address, const uint8_t* bytes, size_t n) { storeBytes(address, bytes, n); });
+    }
 
     /**
-     * @brief The Segment struct
-     * Represents a segment of contiguous memory within the address space.
+     * @brief contains
+     * @returns the segment containing @p address, or nullptr if the address is unmapped. The segment is owned by the
+     * address space and the pointer is valid until the address space is modified.
      */
-    struct Segment : public std::enable_shared_from_this<Segment> {
-        Segment() {}
+    const Segment* contains(T_addr address) const { return m_storage.find(address); }
 
-        /**
-         * @brief start: address of the first byte in this segment
-         */
-        T_addr start;
-        /**
-         * @brief end: address of the last byte in this segment
-         */
-        inline LargeInt end() const { return static_cast<LargeInt>(start) + data.size() - 1; }
-        inline bool contains(const Segment& other) const { return start <= other.start && end() >= other.end(); }
-        inline bool contains(const T_addr addr) const { return start <= addr && addr <= end(); }
-
-        /**
-         * @brief toInterval
-         * @returns an interval object of the given segment. Note that the end of the interval will point to the address
-         * after the end() address. This is done to aid in coalescing adjacent blocks.
-         */
-        T_interval toInterval() {
-            // Edge case: if this segment reaches the top of the address space, we must truncate the interval within the
-            // range of T_addr. This is allowed due to the impossibility of coalescing segments out of bounds of the
-            // address space.
-            LargeInt realEnd = end() + 1;
-            if (realEnd > c_maxAddr) {
-                realEnd = c_maxAddr;
-            }
-            assert(realEnd >= start);
-            return T_interval(start, realEnd, toSPtr());
-        }
-        SegSPtr toSPtr() { return this->shared_from_this(); }
-        bool operator==(const Segment& other) const { return start == other.start && data == other.data; }
-
-        Segment& operator=(const Segment& other) {
-            start = other.start;
-            data = other.data;
-            return *this;
-        }
-        std::vector<uint8_t> data;
-    };
+    /**
+     * @brief getInitSas
+     * @returns the initialization SAS. As the initialization SAS may be modified through the returned reference, the
+     * next reset() will be a full reset, even if dirty tracking is enabled. The initialization SAS keeps the maximum
+     * segment size of this SAS; a different limit set through the returned reference is replaced upon the next reset().
+     */
+    SAS& getInitSas() {
+        if (!m_initData) {
+            m_initData = std::make_unique<SAS>();
+            m_initData->setBackgroundValue(m_background);
+            m_initData->setMaxSegmentSize(m_maxSegSize);
+            if constexpr (T_journal::enabled) {
+                // Writes to the initialization SAS are never rewound
+                m_initData->m_journal.setCapacity(0);
+            }
+        }
+        m_fullResetPending = true;
+        return *m_initData;
+    }
 
-    SparseAddressSpace(const unsigned minSegSize = 5) : m_minSegSize(minSegSize) {
-        assert(m_minSegSize % 2 == 1 && "m_minSegSize must be an uneven value");
-        assert(m_minSegSize >= 3 && "m_minSegSize must be at least 3");
+    /**
+     * @brief setDirtyTracking
+     * Enables or disables incremental resets. When enabled, writes to segments which were created by a reset are
+     * recorded in chunks of 2^@p chunkBits bytes. A subsequent reset() then only restores the written chunks from the
+     * initialization SAS, and drops any segments which did not exist in the initialization SAS. Resetting thus scales
+     * with the number of segments and the amount of written memory, rather than the size of the initialization SAS.
+     * Segments which were coalesced with other segments since the last reset are dropped and shared anew with the
+     * initialization SAS.
+     */
+    void setDirtyTracking(bool enable, unsigned chunkBits = 12) {
+        m_dirtyTracking = enable;
+        m_dirtyChunkBits = chunkBits;
+        m_fullResetPending = true;
     }
 
-    void writeByte(T_addr byteAddress, uint8_t value) {
-        SegSPtr segment = segmentForAddress(byteAddress);
+    const TLBStats& tlbStats() const { return m_tlbStats; }
+    void resetTLBStats() { m_tlbStats = TLBStats(); }
 
-        // Perform write
-        const int wridx = byteAddress - segment->start;
-        assert(wridx >= 0 && wridx < segment->data.size());
-        segment->data[wridx] = value;
+    void clear() {
+        m_storage.clear();
+        flushTLB();
+        clearJournal();
+        m_fullResetPending = true;
+        if (m_initData) {
+            m_initData->clear();
+        }
     }
 
-    template <typename T_v>
-    void writeValue(T_addr byteAddress, T_v value, size_t nbytes) {
-        if (nbytes > sizeof(value)) {
-            throw std::runtime_error("Trying to write more bytes than what is contained in @p value");
+    /**
+     * @brief reset
+     * Resets the address space to the segments of the initialization SAS. The segments are shared copy-on-write with
+     * the initialization SAS, such that resetting is O(number of segments), and the bytes of a segment are only copied
+     * upon the first write to the segment.
+     * If dirty tracking is enabled, only the written parts of the address space are reset; see setDirtyTracking.
+     */
+    void reset() {
+        flushTLB();
+        clearJournal();
+        if (!m_initData) {
+            m_storage.clear();
+            return;
         }
-        for (unsigned i = 0; i < nbytes; i++) {
-            writeByte(byteAddress++, value);
-            value >>= CHAR_BIT;
+        if (m_dirtyTracking && !m_fullResetPending) {
+            incrementalReset();
+            return;
         }
-    }
 
-    template <typename T_v>
-    void writeValue(T_addr byteAddress, T_v value) {
-        writeValue(byteAddress, value, sizeof(T_v));
+        // The shared segments keep their bounds, so they must already be within the limit of this SAS
+        if (m_initData->m_maxSegSize != m_maxSegSize) {
+            m_initData->setMaxSegmentSize(m_maxSegSize);
+        }
+        m_storage.assignShared(m_initData->m_storage);
+        if (m_dirtyTracking) {
+            m_storage.forEach([](Segment& seg) { seg.fromInit = true; });
+            m_fullResetPending = false;
+        }
     }
 
-    uint8_t readByte(T_addr address) const {
-        SegSPtr segment = segmentForAddress(address);
+    /**
+     * @brief snapshot
+     * @returns a snapshot of the current contents of the address space. The snapshot shares the bytes of all segments
+     * copy-on-write, and taking it is thus O(number of segments). The initialization SAS is not part of the snapshot.
+     */
+    Snapshot snapshot() const {
+        auto snap = std::make_shared<T_storage>(m_minSegSize);
+        snap->assignShared(m_storage);
+        return snap;
+    }
 
-        // Perform read
-        const int rdidx = address - segment->start;
-        assert(rdidx >= 0 && rdidx < segment->data.size());
-        return segment->data[rdidx];
+    /**
+     * @brief restore
+     * Restores the contents of the address space to @p snapshot, which may have been taken from any address space of the
+     * same type. Restoring is O(number of segments); the bytes of the snapshot are shared copy-on-write. The next
+     * reset() will be a full reset, even if dirty tracking is enabled.
+     */
+    void restore(const Snapshot& snapshot) {
+        flushTLB();
+        clearJournal();
+        m_storage.assignShared(*snapshot);
+        // The snapshot may have been taken from an address space with a different maximum segment size
+        m_storage.setMaxSegSize(m_maxSegSize, [](const Segment*) {});
+        m_fullResetPending = true;
     }
 
-    template <typename T_v>
-    T_v readValue(T_addr address) const {
-        T_v value = 0;
-        for (unsigned i = 0; i < sizeof(T_v); i++)
-            value |= readByte(address++) << (i * CHAR_BIT);
+    /**
+     * @brief save
+     * Saves the current contents of the address space to the file at @p path; see SASFileFormat. If @p compressed is
+     * set, the bytes of each segment are compressed, using all hardware threads. The initialization SAS is not saved.
+     * The file is written under a temporary name and then renamed, such that segments loaded from a previous version
+     * of the file remain valid.
+     */
+    void save(const std::string& path, bool compressed = false) const {
+        std::vector<const Segment*> segs;
+        segs.reserve(m_storage.size());
+        m_storage.forEach([&](const Segment& seg) { segs.push_back(&seg); });
 
-        return value;
-    }
+        // Compress the chunks of all segments at once, such that segments of any size keep all threads busy
+        constexpr size_t chunkSize = SASFileFormat::c_chunkSize;
+        std::vector<size_t> firstChunk(segs.size() + 1, 0);
+        std::vector<std::vector<uint8_t>> chunks;
+        if (compressed) {
+            // Accessing the bytes of deferred segments fills them, which is not thread-safe for the same segment data;
+            // the workers only see the bytes
+            std::vector<const uint8_t*> bytes(segs.size());
+            for (size_t i = 0; i < segs.size(); i++) {
+                firstChunk[i + 1] = firstChunk[i] + (segs[i]->data.size() + chunkSize - 1) / chunkSize;
+                bytes[i] = segs[i]->data.data();
+            }
+            chunks.resize(firstChunk.back());
+            SASFileFormat::parallelFor(chunks.size(), [&](size_t c) {
+                const size_t i = std::upper_bound(firstChunk.begin(), firstChunk.end(), c) - firstChunk.begin() - 1;
+                const size_t offset = (c - firstChunk[i]) * chunkSize;
+                const size_t n = std::min(chunkSize, segs[i]->data.size() - offset);
+                chunks[c] = SASFileFormat::compressChunk(bytes[i] + offset, n);
+            });
+        }
 
-    SegSPtr contains(uint32_t address) const {
-        auto overlapping = data.findOverlapping(address, address);
-        SegSPtr seg;
-        if (overlapping.size() == 0) {
-            return seg;
+        const size_t headerSize = compressed ? SASFileFormat::c_compressedHeaderSize : SASFileFormat::c_headerSize;
+        const size_t entrySize = compressed ? SASFileFormat::c_compressedEntrySize : SASFileFormat::c_entrySize;
+        std::vector<uint8_t> header(headerSize + segs.size() * entrySize);
+        std::memcpy(header.data(), SASFileFormat::c_magic, sizeof(SASFileFormat::c_magic));
+        SASFileFormat::put(&header[8], compressed ? SASFileFormat::c_compressedVersion : SASFileFormat::c_version, 4);
+        SASFileFormat::put(&header[12], sizeof(T_addr), 4);
+        SASFileFormat::put(&header[16], segs.size(), 8);
+        if (compressed) {
+            SASFileFormat::put(&header[24], chunkSize, 8);
+        }
+        auto align = [compressed](uint64_t offset) {
+            const uint64_t alignment = compressed ? 1 : SASFileFormat::c_payloadAlignment;
+            return (offset + alignment - 1) & ~(alignment - 1);
+        };
+        uint64_t offset = align(header.size());
+        for (size_t i = 0; i < segs.size(); i++) {
+            uint8_t* entry = &header[headerSize + i * entrySize];
+            uint64_t stored = segs[i]->data.size();
+            if (compressed) {
+                stored = (firstChunk[i + 1] - firstChunk[i]) * 4;
+                for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) {
+                    stored += chunks[c].size();
+                }
+                SASFileFormat::put(entry + 24, stored, 8);
+            }
+            SASFileFormat::put(entry, segs[i]->start, 8);
+            SASFileFormat::put(entry + 8, segs[i]->data.size(), 8);
+            SASFileFormat::put(entry + 16, offset, 8);
+            offset = align(offset + stored);
         }
-        assert(overlapping.size() == 1);
 
-        // Query the overlapping segment for whether contains the address. This is to avoid an off-by-1 error
-        // wherein the interval of a segment is inclusive of the address of the first byte after the last byte in
-        // the segment.
-        seg = overlapping[0].value;
-        return seg->contains(address) ? seg : SegSPtr();
+        const std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+            const std::vector<char> padding(SASFileFormat::c_payloadAlignment, 0);
+            file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+            uint64_t position = header.size();
+            for (size_t i = 0; i < segs.size(); i++) {
+                // Pad up to the start of the payload
+                file.write(padding.data(), static_cast<std::streamsize>(align(position) - position));
+                position = align(position);
+                if (compressed) {
+                    std::vector<uint8_t> sizes((firstChunk[i + 1] - firstChunk[i]) * 4);
+                    for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) {
+                        SASFileFormat::put(&sizes[(c - firstChunk[i]) * 4], chunks[c].size(), 4);
+                    }
+                    file.write(reinterpret_cast<const char*>(sizes.data()), static_cast<std::streamsize>(sizes.size()));
+                    position += sizes.size();
+                    for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) {
+                        file.write(reinterpret_cast<const char*>(chunks[c].data()),
+                                   static_cast<std::streamsize>(chunks[c].size()));
+                        position += chunks[c].size();
+                    }
+                } else {
+                    file.write(reinterpret_cast<const char*>(segs[i]->data.data()),
+                               static_cast<std::streamsize>(segs[i]->data.size()));
+                    position += segs[i]->data.size();
+                }
+            }
+            if (!file) {
+                std::remove(tmpPath.c_str());
+                throw std::runtime_error("Could not write " + path);
+            }
+        }
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::remove(tmpPath.c_str());
+            throw std::runtime_error("Could not write " + path);
+        }
     }
 
-    SAS& getInitSas() {
-        if (!m_initData) {
-            m_initData = std::make_unique<SAS>();
+    /**
+     * @brief load
+     * Replaces the contents of the address space with the contents of the snapshot file at @p path, as written by
+     * save(). The file is mapped privately into memory, and the segments use its payloads directly, such that loading
+     * is O(number of segments) and pages are only read from the file once accessed. Segments of compressed snapshot
+     * files are decompressed upon the first access to their bytes; see SASSegmentData::deferred. Segments keep their
+     * saved bounds, unless they exceed the maximum segment size, and adjacent segments are not coalesced.
+     * The initialization SAS is not modified, and the next reset() will be a full reset, as for restore(). Throws if
+     * the file is not a valid snapshot of an address space with addresses of type T_addr, in which case the address
+     * space is not modified.
+     */
+    void load(const std::string& path) {
+        SASSegmentData file = SASSegmentData::mapFile(path, SASSegmentData::MapMode::Private);
+        const uint8_t* bytes = file.data();
+        if (file.size() < SASFileFormat::c_headerSize ||
+            std::memcmp(bytes, SASFileFormat::c_magic, sizeof(SASFileFormat::c_magic)) != 0) {
+            throw std::runtime_error(path + " is not a snapshot file");
+        }
+        const uint64_t version = SASFileFormat::get(bytes + 8, 4);
+        const bool compressed = version == SASFileFormat::c_compressedVersion;
+        if ((version != SASFileFormat::c_version && !compressed) ||
+            SASFileFormat::get(bytes + 12, 4) != sizeof(T_addr)) {
+            throw std::runtime_error("Unsupported snapshot version or address size in " + path);
+        }
+        const size_t headerSize = compressed ? SASFileFormat::c_compressedHeaderSize : SASFileFormat::c_headerSize;
+        const size_t entrySize = compressed ? SASFileFormat::c_compressedEntrySize : SASFileFormat::c_entrySize;
+        const uint64_t count = SASFileFormat::get(bytes + 16, 8);
+        if (file.size() < headerSize || count > (file.size() - headerSize) / entrySize) {
+            throw std::runtime_error("Truncated snapshot file " + path);
+        }
+        const uint64_t chunkSize = compressed ? SASFileFormat::get(bytes + 24, 8) : 0;
+        if (compressed && (chunkSize == 0 || chunkSize > std::numeric_limits<uint32_t>::max())) {
+            throw std::runtime_error("Invalid chunk size in snapshot file " + path);
         }
-        return *m_initData;
-    }
 
-    void clear() {
-        data = SASData();
-        if (m_initData) {
-            m_initData->clear();
+        std::vector<std::pair<size_t, size_t>> payloads(static_cast<size_t>(count));
+        std::vector<Segment> segs(static_cast<size_t>(count));
+        uint64_t prevEnd = 0;
+        for (size_t i = 0; i < segs.size(); i++) {
+            const uint8_t* entry = bytes + headerSize + i * entrySize;
+            const uint64_t start = SASFileFormat::get(entry, 8);
+            const uint64_t size = SASFileFormat::get(entry + 8, 8);
+            const uint64_t offset = SASFileFormat::get(entry + 16, 8);
+            const uint64_t stored = compressed ? SASFileFormat::get(entry + 24, 8) : size;
+            if (size == 0 || (i > 0 && start <= prevEnd) || start > c_maxAddr || size - 1 > c_maxAddr - start ||
+                offset > file.size() || stored > file.size() - offset ||
+                (compressed && !SASFileFormat::validChunks(bytes + offset, size, stored, chunkSize))) {
+                throw std::runtime_error("Invalid segment table in snapshot file " + path);
+            }
+            prevEnd = start + (size - 1);
+            segs[i].start = static_cast<T_addr>(start);
+            payloads[i] = {static_cast<size_t>(offset), static_cast<size_t>(stored)};
+        }
+        std::vector<SASSegmentData> data = std::move(file).split(payloads);
+        for (size_t i = 0; i < segs.size(); i++) {
+            if (compressed) {
+                const size_t size = static_cast<size_t>(SASFileFormat::get(bytes + headerSize + i * entrySize + 8, 8));
+                auto fill = [payload = std::move(data[i]), size, chunkSize](uint8_t* dst) {
+                    SASFileFormat::decompressSegment(payload.data(), size, static_cast<size_t>(chunkSize), dst);
+                };
+                segs[i].data = SASSegmentData::deferred(size, std::move(fill));
+            } else {
+                segs[i].data = std::move(data[i]);
+            }
         }
-    }
 
-    void reset() {
-        data = SASData();
+        flushTLB();
+        clearJournal();
+        m_storage.clear();
+        // The segments are disjoint, and are inserted with their saved bounds, as coalescing adjacent segments would copy
+        // their mapped bytes and decompress them eagerly. The file may have been saved under a different limit.
+        for (Segment& seg : segs) {
+            m_storage.insertDisjoint(std::move(seg));
+        }
+        m_storage.setMaxSegSize(m_maxSegSize, [](const Segment*) {});
+        m_fullResetPending = true;
+    }
 
-        // Deep copy all segments in the initialization data to the current data
+    /**
+     * @brief fork
+     * @returns a new address space with the same contents, initialization SAS and configuration as this address space.
+     * All bytes are shared copy-on-write, such that forking is O(number of segments), and the fork and this address
+     * space evolve independently afterwards. Forks may be used from different threads, given that no thread modifies an
+     * address space while it is being forked: the copy-on-write check synchronizes with owners of shared bytes which
+     * drop them on other threads, see SASSegmentData::isShared.
+     */
+    SAS fork() const {
+        SAS f(m_minSegSize, static_cast<unsigned>(m_tlb.size()));
+        f.m_storage.assignShared(m_storage);
         if (m_initData) {
-            m_initData->data.visit_all([=](const auto& interval) {
-                /*
-                Segment segCopy = *interval.value;
-                // Initialize the shared_ptr required for std::shared_from_this
-                SegSPtr segCopyPtr = std::make_shared<Segment>(segCopy);
-                */
-                SegSPtr segCopyPtr = std::make_shared<Segment>(*interval.value);
-                insertSegment(*segCopyPtr);
-            });
+            f.m_initData = std::make_unique<SAS>(m_initData->fork());
+        }
+        f.m_dirtyTracking = m_dirtyTracking;
+        f.m_dirtyChunkBits = m_dirtyChunkBits;
+        f.m_readMode = m_readMode;
+        f.m_background = m_background;
+        f.m_storage.setBackground(m_background);
+        f.m_maxSegSize = m_maxSegSize;
+        f.m_storage.setMaxSegSize(m_maxSegSize, [](const Segment*) {});
+        f.m_coalescing = m_coalescing;
+        f.m_compactionThreshold = m_compactionThreshold;
+        f.m_storage.setCoalescing(m_coalescing);
+        if constexpr (T_journal::enabled) {
+            // The fork starts out with an empty journal
+            f.m_journal.setCapacity(m_journal.capacity());
+            f.m_journal.setStep(m_journal.step());
+            f.m_journal.clear();
         }
+        return f;
     }
 
     /**
      * @brief insertSegment
-     * Inserts memory segment @p segment at the specified starting address.
-     * If the segment overlaps any other memory segments, these will be coalesced, with overlapping
-     * memory values being taken from the newly inserted segment. We only check for overlaps at the
-     * start and stop address. Any segments contained within the newly inserted segment will be
-     * deleted.
+     * Inserts memory segment @p segment at the specified starting address. Any bytes already present at the addresses of
+     * @p segment are overwritten by the bytes of @p segment. How the segment is placed in the address space is
+     * determined by the storage policy; see IntervalStorage::insert and PageTableStorage::insert.
      */
-    void insertSegment(Segment& segment) {
+    void insertSegment(Segment&& segment) {
         if (segment.data.size() == 0) {
             // Nothing to do
             return;
         }
-
-        /** Struct wrapper around an interval pointer to ensure that std::set does not try to
-         * overload resolve with an iterator*/
-        std::set<SegSPtr> segmentsToKeep;
-        data.visit_all([&](auto& interval) { segmentsToKeep.insert(interval.value); });
-
-        // Locate segments which are fully contained within the new segment. These contained
-        // segments shall be removed.
-        std::vector<T_interval> contained = data.findContained(segment.start, segment.end());
-        for (auto& i : contained) {
-            segmentsToKeep.erase(i.value);
-        }
-
-        // Coalesce any overlapping upper and lower segments into the new segment. Address segment->end() + 1 ensures
-        // coalescing of adjacent blocks
-        const std::vector<LargeInt> edges = {segment.start, segment.end() + 1};
-        for (LargeInt edgeAddress : edges) {
-            std::vector<T_interval> overlaps = data.findOverlapping(edgeAddress, edgeAddress);
-            for (auto& i : overlaps) {
-                segmentsToKeep.erase(i.value);
-                coalesce(*i.value, segment);
-            }
+        if constexpr (T_journal::enabled) {
+            m_journal.record(segment.start, segment.data.size(),
+                             [&](T_addr address, uint8_t* dst, size_t n) { readBytes(address, dst, n); });
         }
+        segment.fromInit = false;
+        segment.dirtyChunks.clear();
 
-        // convert segments to keep into format required by IntervalTree
-        std::vector<T_interval> segmentsToKeepVec;
-        for (const auto& seg : segmentsToKeep) {
-            segmentsToKeepVec.push_back(seg->toInterval());
+        const T_addr start = segment.start;
+        const size_t n = segment.data.size();
+        m_storage.insert(std::move(segment), [&](const Segment* removed) { invalidateTLB(removed); });
+        if (m_dirtyTracking) {
+            markDirty(start, n);
         }
+        compactIfFragmented();
+    }
 
-        // Insert (coalesced) new segment into segments to keep
-        segmentsToKeepVec.push_back(segment.toInterval());
+    /**
+     * @brief insertSegment
+     * Inserts a copy of @p segment, see insertSegment(Segment&&). @p segment itself is not modified.
+     */
+    void insertSegment(const Segment& segment) { insertSegment(Segment(segment)); }
 
-        // Rebuild the interval tree with the new set of (coalesced) intervals. std::move is used due to the r-value
-        // reference constraint of the IntervalTree constructor
-        data = SASData(std::move(segmentsToKeepVec));
-        setMRUSeg(segment.toSPtr());
+    void insertSegment(const T_addr startaddr, std::vector<uint8_t>&& data) {
+        Segment s;
+        s.start = startaddr;
+        s.data = std::move(data);
+        insertSegment(std::move(s));
     }
 
     void insertSegment(const T_addr startaddr, const std::vector<uint8_t>& data) {
-        auto s = std::make_shared<Segment>();
-        s->data = data;
-        s->start = startaddr;
-        insertSegment(*s);
+        insertSegment(startaddr, std::vector<uint8_t>(data));
     }
 
     void insertSegment(const T_addr startaddr, const uint8_t* data, size_t n) {
         insertSegment(startaddr, std::vector<uint8_t>(data, data + n));
     }
 
+    /**
+     * @brief insertFile
+     * Inserts a segment at @p startaddr backed by @p length bytes of the file at @p path, starting at byte @p offset;
+     * see SASSegmentData::mapFile. Inserting is independent of the size of the file, as pages are only read from the
+     * file once accessed. The segment remains backed by the file for as long as it is not coalesced with neighboring
+     * segments, which with IntervalStorage requires that it does not overlap or abut other segments.
+     */
+    void insertFile(const T_addr startaddr, const std::string& path,
+                    SASSegmentData::MapMode mode = SASSegmentData::MapMode::Private, uint64_t offset = 0,
+                    size_t length = 0) {
+        Segment s;
+        s.start = startaddr;
+        s.data = SASSegmentData::mapFile(path, mode, offset, length);
+        if (s.data.size() > 0 &&
+            static_cast<uint64_t>(s.data.size() - 1) > static_cast<uint64_t>(c_maxAddr - startaddr)) {
+            throw std::runtime_error("Trying to insert a file beyond the end of the address space");
+        }
+        insertSegment(std::move(s));
+    }
+
+    /**
+     * @brief insertSegments
+     * Inserts all of @p segments at once. The result is the same as inserting the segments one at a time in order, ie.
+     * bytes of later segments take precedence over bytes of earlier segments, but the segment index is only built once;
+     * see IntervalStorage::insertBulk.
+     */
+    void insertSegments(std::vector<Segment>&& segments) {
+        segments.erase(std::remove_if(segments.begin(), segments.end(),
+                                      [](const Segment& seg) { return seg.data.size() == 0; }),
+                       segments.end());
+        std::vector<std::pair<T_addr, size_t>> spans;
+        spans.reserve(segments.size());
+        for (Segment& seg : segments) {
+            seg.fromInit = false;
+            seg.dirtyChunks.clear();
+            spans.emplace_back(seg.start, seg.data.size());
+            if constexpr (T_journal::enabled) {
+                m_journal.record(seg.start, seg.data.size(),
+                                 [&](T_addr address, uint8_t* dst, size_t n) { readBytes(address, dst, n); });
+            }
+        }
+
+        m_storage.insertBulk(std::move(segments), [&](const Segment* removed) { invalidateTLB(removed); });
+        if (m_dirtyTracking) {
+            for (const auto& span : spans) {
+                markDirty(span.first, span.second);
+            }
+        }
+        compactIfFragmented();
+    }
+
+    /**
+     * @brief insertSegments
+     * Inserts copies of the segments in [@p begin, @p end), see insertSegments(std::vector<Segment>&&). The bytes of the
+     * segments are shared copy-on-write rather than copied.
+     */
+    template <typename T_it>
+    void insertSegments(T_it begin, T_it end) {
+        std::vector<Segment> segments;
+        if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                      typename std::iterator_traits<T_it>::iterator_category>::value) {
+            segments.reserve(std::distance(begin, end));
+        }
+        for (; begin != end; ++begin) {
+            segments.emplace_back();
+            segments.back().start = begin->start;
+            segments.back().data = begin->data;
+        }
+        insertSegments(std::move(segments));
+    }
+
+    /**
+     * @brief segments
+     * @returns pointers to all segments in the address space, in address order. A pointer expires once its segment is
+     * removed, including when it is coalesced into another segment or the address space is cleared or destroyed. Until
+     * then, modifications of the address space may change the bounds and bytes of the segment.
+     */
     std::vector<SegWPtr> segments() const {
         std::vector<SegWPtr> segs;
-        data.visit_all([&](const auto& interval) { segs.emplace_back(interval.value); });
+        segs.reserve(m_storage.size());
+        m_storage.forEach([&](const Segment& seg) { segs.emplace_back(m_storage.share(seg)); });
         return segs;
     }
 
 private:
     /**
-     * @brief segmentForAddress
-     * @returns a segment containing the requested byte address @param addr. If no segment is found, a new segment is
-     * created. segmentForAddress may create new segments if a segment is missing.
-     *
-     * As such, the physical state of the SAS may be modified in the function, however the logical state (which is an
-     * unrestricted address space) is maintained - hence, the function is marked const.
+     * @brief journal
+     * Records the @p n bytes at offset @p offset within @p segment, which are about to be overwritten at @p address.
+     * Compiles to nothing if the journal policy does not record writes.
      */
-    SegSPtr segmentForAddress(T_addr addr) const {
-        // Physical changes to the SAS are performed through a non-const pointer to this
-        auto* thisNonConst = const_cast<SAS*>(this);
+    inline void journal(T_addr address, const Segment& segment, size_t offset, size_t n) {
+        if constexpr (T_journal::enabled) {
+            m_journal.record(address, n, [&](T_addr a, uint8_t* dst, size_t len) {
+                std::memcpy(dst, segment.data.data() + offset + (a - address), len);
+            });
+        }
+    }
 
-        SegSPtr seg;
-        // Initially, check if MRU segment is our target segment, to speed up spatial locality accesses. Else, traverse
-        // the sparse array
-        if (m_mruSegment && m_mruSegment->contains(addr)) {
-            // MRU access
-            seg = m_mruSegment;
-        } else if ((seg = contains(addr))) {
-            return seg;
-        } else {
-            // No segment contains the requested address, create new segment and retry
-            thisNonConst->createMissingSegment(addr);
-            return segmentForAddress(addr);
+    void clearJournal() {
+        if constexpr (T_journal::enabled) {
+            m_journal.clear();
         }
+    }
 
-        thisNonConst->setMRUSeg(seg);
-        return seg;
+    /**
+     * @brief storeBytes
+     * Writes @p n bytes from @p src starting at @p address, without journaling the write.
+     */
+    void storeBytes(T_addr address, const uint8_t* src, size_t n) {
+        while (n > 0) {
+            Segment& seg = segmentForAddress(address);
+            const size_t offset = address - seg.start;
+            const size_t chunk = std::min(n, seg.data.size() - offset);
+            std::memcpy(seg.data.mutableData() + offset, src, chunk);
+            markDirty(seg, offset, chunk);
+            src += chunk;
+            address += chunk;
+            n -= chunk;
+        }
     }
 
-    void createMissingSegment(T_addr addr) {
-        assert(!contains(addr));
-        std::vector<T_interval> intervals;
-        // Find near segments to the missing address
-        data.visit_all([&](auto& interval) { intervals.emplace_back(interval); });
+    /**
+     * @brief compactIfFragmented
+     * Compacts the address space if coalescing is deferred and the fragmentation exceeds the compaction threshold.
+     */
+    void compactIfFragmented() {
+        if (m_coalescing != SASCoalescing::Eager && m_compactionThreshold > 0 &&
+            m_storage.fragmentation() > m_compactionThreshold) {
+            compact();
+        }
+    }
 
-        // Find closest upper and lower segments to the address
-        const T_interval* lower = nullptr;
-        const T_interval* upper = nullptr;
-
-        for (const auto& interval : intervals) {
-            if (interval.stop <= addr) {
-                if (!lower) {
-                    lower = &interval;
-                } else if (interval.stop > lower->stop) {
-                    lower = &interval;
-                }
-            }
+    /**
+     * @brief markDirty
+     * Records a write of @p n bytes at offset @p offset within @p segment, if dirty tracking is enabled.
+     */
+    inline void markDirty(Segment& segment, size_t offset, size_t n) {
+        if (!m_dirtyTracking || !segment.fromInit) {
+            return;
+        }
+        if (segment.dirtyChunks.empty()) {
+            segment.dirtyChunks.resize(((segment.data.size() - 1) >> m_dirtyChunkBits) / 64 + 1);
+        }
+        const size_t last = (offset + n - 1) >> m_dirtyChunkBits;
+        for (size_t chunk = offset >> m_dirtyChunkBits; chunk <= last; chunk++) {
+            segment.dirtyChunks[chunk / 64] |= uint64_t(1) << (chunk % 64);
+        }
+    }
 
-            if (interval.start > addr) {
-                if (!upper) {
-                    upper = &interval;
-                } else if (interval.start < upper->start) {
-                    upper = &interval;
-                }
+    /**
+     * @brief markDirty
+     * Records a write of @p n bytes at @p address, which may span multiple segments.
+     */
+    void markDirty(T_addr address, size_t n) {
+        while (n > 0) {
+            Segment* seg = m_storage.find(address);
+            if (!seg) {
+                return;
             }
+            const size_t offset = address - seg->start;
+            const size_t chunk = std::min(n, seg->data.size() - offset);
+            markDirty(*seg, offset, chunk);
+            address += chunk;
+            n -= chunk;
         }
+    }
 
-        // Create a segment centered at the requested address with size m_minSegSize. If such a new segment
-        // overlaps with the closest segments to the new segment, the new segment will adjusted accordingly (either
-        // truncated or shifted wrt. the center address). We ensure that the bounds of the new segment is adjusted to
-        // facilitate coalescing when inserted.
-        LargeInt newstart = static_cast<LargeInt>(addr) - m_minSegSize / 2;
-        const int adjustStart = newstart < 0 ? -newstart : 0;
-        newstart += adjustStart;
-        LargeInt newstop = static_cast<LargeInt>(addr) + m_minSegSize / 2 + 1 + adjustStart;
+    /**
+     * @brief incrementalReset
+     * Resets the address space using the dirty tracking information recorded since the last reset. Segments which are
+     * not fromInit are dropped. The remaining segments have the exact bounds of a segment of the initialization SAS,
+     * and only their written chunks are restored. Lastly, any initialization segments missing from the address space
+     * are shared anew.
+     */
+    void incrementalReset() {
+        m_storage.removeIf([](const Segment& seg) { return !seg.fromInit; }, [](const Segment*) {});
 
-        if (lower && static_cast<T_addr>(lower->stop) >= newstart) {
-            const auto truncatedBytes = static_cast<T_addr>(lower->stop) - newstart;
-            newstart = lower->stop;
+        std::vector<Segment*> kept;
+        m_storage.forEach([&](Segment& seg) { kept.push_back(&seg); });
 
-            // Add the truncated bytes to the other end of the new segment
-            newstop += truncatedBytes;
-        }
+        // Both the kept segments and the initialization segments are in address order
+        auto k = kept.begin();
+        m_initData->m_storage.forEach([&](const Segment& init) {
+            if (k != kept.end() && (*k)->start == init.start) {
+                restoreDirtyChunks(**k, init);
+                ++k;
+            } else {
+                // Initialization segments may be adjacent, eg. if split at the maximum segment size; the copy must keep
+                // the bounds of its initialization segment
+                Segment copy(init);
+                copy.fromInit = true;
+                m_storage.insertDisjoint(std::move(copy));
+            }
+        });
+        assert(k == kept.end());
+    }
 
-        if (upper && static_cast<T_addr>(upper->start) <= newstop) {
-            newstop = static_cast<T_addr>(upper->start);
+    /**
+     * @brief restoreDirtyChunks
+     * Copies the dirty chunks of @p segment from @p init, which has the same bounds as @p segment.
+     */
+    void restoreDirtyChunks(Segment& segment, const Segment& init) {
+        assert(segment.start == init.start && segment.data.size() == init.data.size());
+        const size_t chunkSize = size_t(1) << m_dirtyChunkBits;
+        for (size_t w = 0; w < segment.dirtyChunks.size(); w++) {
+            uint64_t bits = segment.dirtyChunks[w];
+            while (bits) {
+                const size_t chunk = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                const size_t offset = chunk << m_dirtyChunkBits;
+                const size_t n = std::min(chunkSize, segment.data.size() - offset);
+                std::memcpy(segment.data.mutableData() + offset, init.data.data() + offset, n);
+            }
+            segment.dirtyChunks[w] = 0;
         }
-        if (newstop > c_maxAddr) {
-            // Truncate within address space. Newstop always points to the first address after the last byte of the new
-            // segment. In this case, this address is outside of the T_addr address space, however, the below adjustment
-            // of newstop ensures that we are able to allocate a segment up to and including the last address in the
-            // address space.
-            newstop = c_maxAddr + 1;
+    }
+
+    /**
+     * @brief checkSpan
+     * Throws if the span of @p n bytes starting at @p address exceeds the address space.
+     */
+    static void checkSpan(T_addr address, size_t n) {
+        if (n > 0 && static_cast<uint64_t>(n - 1) > static_cast<uint64_t>(c_maxAddr - address)) {
+            throw std::runtime_error("Trying to access bytes beyond the end of the address space");
         }
-        const int segsize = newstop - newstart;
-        assert(segsize != 0);
-        insertSegment(static_cast<T_addr>(newstart), std::vector<uint8_t>(segsize, 0));
     }
 
-    inline void setMRUSeg(SegSPtr ptr) {
-        if (m_mruSegment != ptr) {
-            m_mruSegment = ptr;
+    /**
+     * @brief lookup
+     * @returns the segment containing @p addr, or nullptr if the address is unmapped. No segment is created.
+     */
+    const Segment* lookup(T_addr addr) const {
+        auto* thisNonConst = const_cast<SAS*>(this);
+        Segment*& entry = thisNonConst->m_tlb[tlbIndex(addr)];
+        if (entry && entry->contains(addr)) {
+            thisNonConst->m_tlbStats.hits++;
+            return entry;
+        }
+        thisNonConst->m_tlbStats.misses++;
+
+        Segment* seg = m_storage.find(addr);
+        if (seg) {
+            entry = seg;
         }
+        return seg;
     }
 
     /**
-     * @brief coalesce
-     * Coalesce two segments, using values of @p s2 for any overlapping addresses between @p s1 and
-     * @p s2.
+     * @brief segmentForAddress
+     * @returns a segment containing the requested byte address @param addr. If no segment is found, a new segment is
+     * created. segmentForAddress may create new segments if a segment is missing.
+     *
+     * As such, the physical state of the SAS may be modified in the function, however the logical state (which is an
+     * unrestricted address space) is maintained - hence, the function is marked const.
      */
-    Segment& coalesce(Segment& s1, Segment& s2) {
-        if (s2.contains(s1)) {
-            return s2;
+    Segment& segmentForAddress(T_addr addr) const {
+        // Physical changes to the SAS are performed through a non-const pointer to this
+        auto* thisNonConst = const_cast<SAS*>(this);
+
+        // Initially, check the lookup cache, to speed up accesses with spatial locality. Else, traverse the segment index
+        Segment*& entry = thisNonConst->m_tlb[tlbIndex(addr)];
+        if (entry && entry->contains(addr)) {
+            thisNonConst->m_tlbStats.hits++;
+            return *entry;
         }
+        thisNonConst->m_tlbStats.misses++;
 
-        // Coalesce lower
-        const int coalesce_lower_bytes = s2.start - s1.start;
-        if (coalesce_lower_bytes > 0) {
-            s2.data.insert(s2.data.begin(), s1.data.begin(), s1.data.begin() + coalesce_lower_bytes);
-            s2.start = s1.start;
+        Segment* seg = m_storage.find(addr);
+        if (!seg) {
+            // No segment contains the requested address, create new segment
+            thisNonConst->m_storage.createMissing(addr,
+                                                  [&](const Segment* removed) { thisNonConst->invalidateTLB(removed); });
+            thisNonConst->compactIfFragmented();
+            seg = m_storage.find(addr);
+            assert(seg);
         }
 
-        // Coalesce upper
-        const int coalesce_upper_bytes = s1.end() - s2.end();
-        if (coalesce_upper_bytes > 0) {
-            s2.data.insert(s2.data.end(), s1.data.end() - coalesce_upper_bytes, s1.data.end());
+        entry = seg;
+        return *seg;
+    }
+
+    /**
+     * @brief tlbIndex
+     * @returns the lookup cache entry for @p addr. The cache is direct-mapped on a multiplicative hash of the page
+     * number of the address. Hashing ensures that accesses to distinct, similarly aligned regions (ie. code, stack and
+     * heap) tend to map to distinct entries.
+     */
+    inline size_t tlbIndex(T_addr addr) const {
+        const uint64_t page = addr >> c_tlbPageBits;
+        return static_cast<size_t>((page * 0x9E3779B97F4A7C15ull) >> 40) & m_tlbMask;
+    }
+
+    /**
+     * @brief invalidateTLB
+     * Removes any lookup cache entries referencing @p segment. Must be called whenever a segment is removed from the
+     * index.
+     */
+    void invalidateTLB(const Segment* segment) {
+        for (auto& entry : m_tlb) {
+            if (entry == segment) {
+                entry = nullptr;
+            }
         }
+    }
 
-        return s2;
+    void flushTLB() {
+        std::fill(m_tlb.begin(), m_tlb.end(), nullptr);
     }
 
     /**
@@ -370,26 +3014,72 @@ private:
     std::unique_ptr<SAS> m_initData;
 
     /**
-     * @brief data
-     * Interval tree representing the currently active segments in the address space.
+     * @brief m_storage
+     * Storage policy holding the currently active segments in the address space.
      */
-    SASData data;
+    T_storage m_storage;
+
+    /**
+     * @brief m_tlb
+     * Direct-mapped cache of recently accessed segments, indexed by tlbIndex(). The cache entry of an address will be
+     * checked on each read/write before traversing the segment index. Entries only ever reference segments present in
+     * the index.
+     * Entries are per page rather than per segment, so a segment spanning several pages occupies one entry for each
+     * accessed page. The default of 64 entries covers 256 KiB of recently accessed pages; with fewer entries, accesses
+     * spread over the pages of a single large segment already evict each other.
+     */
+    std::vector<Segment*> m_tlb;
+    const size_t m_tlbMask;
+    TLBStats m_tlbStats;
 
     /**
-     * @brief m_mruSegment
-     * Pointer to the most recently accessed segment in the address space. This segment will be checked on each
-     * read/write to speed up accesses with spatial locality.
+     * @brief m_dirtyTracking
+     * Whether writes are recorded for incremental resets, see setDirtyTracking. m_fullResetPending is set whenever the
+     * segments of the address space can no longer be related to the initialization SAS through the fromInit flags
+     * alone, ie. after the initialization SAS has been accessed or the address space has been cleared.
      */
-    SegSPtr m_mruSegment;
+    bool m_dirtyTracking = false;
+    unsigned m_dirtyChunkBits = 12;
+    bool m_fullResetPending = true;
 
     /**
      * @brief m_minSegSize
-     * Minimum segment size, in bytes.
-     * When an address which is not contained within any segment is accessed, a new segment is created around the
-     * address. This segment will (assuming no conflicts with adjacent segments, see createMissingSegment) have
-     * m_minSegSize width, centerred around the requested address.
+     * Minimum segment size given upon construction, used for constructing snapshots and forks.
      */
-    const unsigned m_minSegSize;
+    unsigned m_minSegSize;
+
+    /**
+     * @brief m_readMode
+     * How readByte and readValue treat unmapped addresses, see setReadMode. m_background is the value of unmapped
+     * bytes, see setBackgroundValue.
+     */
+    SASReadMode m_readMode = SASReadMode::Materialize;
+    uint8_t m_background = 0;
+
+    /**
+     * @brief m_maxSegSize
+     * Maximum segment size, see setMaxSegmentSize.
+     */
+    size_t m_maxSegSize = 0;
+
+    /**
+     * @brief m_coalescing
+     * When segments are coalesced, see setCoalescing.
+     */
+    SASCoalescing m_coalescing = SASCoalescing::Eager;
+    double m_compactionThreshold = 0.5;
+
+    /**
+     * @brief m_journal
+     * Records writes for rewindTo, if enabled by the journal policy.
+     */
+    T_journal m_journal;
+
+    /**
+     * @brief c_tlbPageBits
+     * Number of low address bits ignored when indexing the lookup cache.
+     */
+    constexpr static unsigned c_tlbPageBits = 12;
 };
 
 #ifdef USE_SAS_NAMESPACE
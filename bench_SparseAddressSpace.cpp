@@ -0,0 +1,681 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "ConcurrentSparseAddressSpace.h"
+#include "ElfLoader.h"
+#include "ShardedSparseAddressSpace.h"
+#include "SparseAddressSpace.h"
+
+using IntervalSAS = SparseAddressSpace<uint32_t>;
+using PageTableSAS = SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>;
+using JournaledSAS = SparseAddressSpace<uint32_t, IntervalStorage<uint32_t>, UndoJournal<uint32_t>>;
+
+/**
+ * @brief benchmark
+ * Runs @p fn once and reports the average time per operation, given that @p fn performs @p ops operations.
+ */
+static void benchmark(const std::string& name, size_t ops, const std::function<void()>& fn) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const auto stop = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    std::printf("%-64s %12zu ops %12.2f ns/op\n", name.c_str(), ops, ns / ops);
+}
+
+/**
+ * @brief fragment
+ * Populates @p sas with @p nSegments single-byte segments, separated by gaps of @p stride - 1 unmapped bytes.
+ */
+template <typename SAS>
+static void fragment(SAS& sas, size_t nSegments, uint32_t stride) {
+    for (size_t i = 0; i < nSegments; i++) {
+        sas.insertSegment(static_cast<uint32_t>(i * stride), std::vector<uint8_t>(1, 0xFF));
+    }
+}
+
+template <typename SAS>
+static void benchFragmented(const std::string& backend) {
+    constexpr size_t nSegments = 100000;
+    constexpr uint32_t stride = 16;
+
+    SAS sas;
+    benchmark(backend + "fragment: insert 1e5 disjoint segments", nSegments, [&] { fragment(sas, nSegments, stride); });
+
+    // Each access falls in the middle of a gap, and thus creates a new segment which must be placed relative to its
+    // closest neighbors.
+    benchmark(backend + "fragment: first-touch write between 1e5 segments", nSegments, [&] {
+        for (size_t i = 0; i < nSegments; i++) {
+            sas.writeByte(static_cast<uint32_t>(i * stride + stride / 2), 1);
+        }
+    });
+
+    // Accesses alternate between far-apart segments, defeating the MRU segment.
+    volatile uint8_t sink = 0;
+    benchmark(backend + "fragment: scattered reads over 1e5 segments", nSegments, [&] {
+        for (size_t i = 0; i < nSegments; i++) {
+            const size_t seg = (i * 7919) % nSegments;
+            sink = sas.readByte(static_cast<uint32_t>(seg * stride));
+        }
+    });
+    (void)sink;
+}
+
+template <typename SAS>
+static void benchInsertSegments(const std::string& backend) {
+    // 1e5 disjoint segments in shuffled order, inserted one at a time and all at once
+    constexpr size_t nSegments = 100000;
+    std::vector<typename SAS::Segment> segs(nSegments);
+    for (size_t i = 0; i < nSegments; i++) {
+        segs[i].start = static_cast<uint32_t>(((i * 7919) % nSegments) * 64);
+        segs[i].data = std::vector<uint8_t>(32, 0xFF);
+    }
+
+    {
+        SAS sas;
+        auto copy = segs;
+        benchmark(backend + "insert: 1e5 shuffled segments via insertSegment", nSegments, [&] {
+            for (auto& seg : copy) {
+                sas.insertSegment(std::move(seg));
+            }
+        });
+    }
+    SAS sas;
+    auto copy = segs;
+    benchmark(backend + "insert: 1e5 shuffled segments via insertSegments", nSegments,
+              [&] { sas.insertSegments(std::move(copy)); });
+}
+
+template <typename SAS>
+static void benchBulk(const std::string& backend) {
+    constexpr size_t nBytes = 1 << 18;
+    constexpr size_t chunk = 4096;
+    std::vector<uint8_t> buf(chunk, 0xAB);
+
+    {
+        SAS sas;
+        benchmark(backend + "bulk: 256 KiB via writeByte", nBytes, [&] {
+            for (size_t i = 0; i < nBytes; i++) {
+                sas.writeByte(static_cast<uint32_t>(i), buf[i % chunk]);
+            }
+        });
+    }
+
+    SAS sas;
+    benchmark(backend + "bulk: 256 KiB via 4 KiB writeBytes", nBytes, [&] {
+        for (size_t i = 0; i < nBytes; i += chunk) {
+            sas.writeBytes(static_cast<uint32_t>(i), buf.data(), chunk);
+        }
+    });
+    benchmark(backend + "bulk: 256 KiB via 4 KiB readBytes", nBytes, [&] {
+        for (size_t i = 0; i < nBytes; i += chunk) {
+            sas.readBytes(static_cast<uint32_t>(i), buf.data(), chunk);
+        }
+    });
+}
+
+template <typename SAS>
+static void benchValues(const std::string& backend) {
+    constexpr size_t nBytes = 1 << 20;
+    constexpr size_t nOps = nBytes / sizeof(uint64_t);
+    SAS sas;
+    std::vector<uint8_t> init(nBytes, 0);
+    sas.insertSegment(0, init);
+
+    benchmark(backend + "values: 64-bit writeValue", nOps, [&] {
+        for (size_t i = 0; i < nBytes; i += sizeof(uint64_t)) {
+            sas.writeValue(static_cast<uint32_t>(i), static_cast<uint64_t>(i));
+        }
+    });
+    volatile uint64_t sink = 0;
+    benchmark(backend + "values: 64-bit readValue", nOps, [&] {
+        for (size_t i = 0; i < nBytes; i += sizeof(uint64_t)) {
+            sink = sas.template readValue<uint64_t>(static_cast<uint32_t>(i));
+        }
+    });
+    (void)sink;
+}
+
+template <typename SAS>
+static void benchLookupCache(const std::string& backend) {
+    // Round-robin accesses to code, stack and heap-like regions, each populated with many small segments. Each region
+    // slowly moves between its segments.
+    const std::vector<uint32_t> regions = {0x1000, 0x7FFF0000, 0x10000000};
+    constexpr size_t nOps = 1 << 20;
+
+    for (unsigned entries : {1u, 4u, 16u, 64u}) {
+        SAS sas(5, entries);
+        for (uint32_t r : regions) {
+            for (uint32_t i = 0; i < 64; i++) {
+                sas.insertSegment(r + i * 0x1000, std::vector<uint8_t>(0x100, 0));
+            }
+        }
+
+        volatile uint8_t sink = 0;
+        const std::string name = backend + "tlb: 3 regions, " + std::to_string(entries) + " entries";
+        benchmark(name, nOps, [&] {
+            for (size_t i = 0; i < nOps; i++) {
+                const uint32_t page = (i / 1024 * 17) % 64;
+                sink = sas.readByte(regions[i % 3] + page * 0x1000 + (i & 0xFF));
+            }
+        });
+        std::printf("%-64s %16.3f\n", "  hit rate", sas.tlbStats().hitRate());
+        (void)sink;
+    }
+}
+
+template <typename SAS>
+static void benchReset(const std::string& backend) {
+    // A 64 MiB initialization image split over 1024 segments, of which a single byte is touched between resets
+    constexpr size_t nSegments = 1024;
+    constexpr size_t segSize = 1 << 16;
+    constexpr size_t nResets = 100;
+    SAS sas;
+    for (size_t i = 0; i < nSegments; i++) {
+        sas.getInitSas().insertSegment(static_cast<uint32_t>(i * 2 * segSize), std::vector<uint8_t>(segSize, 1));
+    }
+
+    benchmark(backend + "reset: 64 MiB image, 1 byte touched", nResets, [&] {
+        for (size_t i = 0; i < nResets; i++) {
+            sas.reset();
+            sas.writeByte(static_cast<uint32_t>(i * 2 * segSize), 2);
+        }
+    });
+
+    sas.setDirtyTracking(true);
+    sas.reset();
+    benchmark(backend + "reset: 64 MiB image, 1 byte touched, dirty tracking", nResets, [&] {
+        for (size_t i = 0; i < nResets; i++) {
+            sas.reset();
+            sas.writeByte(static_cast<uint32_t>(i * 2 * segSize), 2);
+        }
+    });
+}
+
+template <typename SAS>
+static void benchSnapshot(const std::string& backend) {
+    // 1024 segments of 64 KiB, of which a single byte is touched between restores
+    constexpr size_t nSegments = 1024;
+    constexpr size_t segSize = 1 << 16;
+    constexpr size_t nOps = 100;
+    SAS sas;
+    for (size_t i = 0; i < nSegments; i++) {
+        sas.insertSegment(static_cast<uint32_t>(i * 2 * segSize), std::vector<uint8_t>(segSize, 1));
+    }
+
+    typename SAS::Snapshot snap;
+    benchmark(backend + "snapshot: 64 MiB, 1024 segments", nOps, [&] {
+        for (size_t i = 0; i < nOps; i++) {
+            snap = sas.snapshot();
+        }
+    });
+    benchmark(backend + "snapshot: restore 64 MiB, 1 byte touched", nOps, [&] {
+        for (size_t i = 0; i < nOps; i++) {
+            sas.restore(snap);
+            sas.writeByte(static_cast<uint32_t>(i * 2 * segSize), 2);
+        }
+    });
+    benchmark(backend + "snapshot: fork 64 MiB, 1 byte touched", nOps, [&] {
+        for (size_t i = 0; i < nOps; i++) {
+            SAS f = sas.fork();
+            f.writeByte(static_cast<uint32_t>(i * 2 * segSize), 2);
+        }
+    });
+}
+
+/**
+ * @brief benchProbe
+ * Reads one 64-bit value of each 4 KiB of a 256 MiB unmapped region, as page-table walks and memory scrubbers do, with
+ * and without materializing segments upon reading.
+ */
+template <typename SAS>
+static void benchProbe(const std::string& backend) {
+    constexpr size_t nOps = (256 << 20) / 4096;
+    for (const auto mode : {SASReadMode::Materialize, SASReadMode::Background}) {
+        SAS sas;
+        sas.setReadMode(mode);
+        uint64_t sum = 0;
+        const std::string name =
+            backend + "probe: 256 MiB unmapped, " + (mode == SASReadMode::Materialize ? "materialize" : "background");
+        benchmark(name, nOps, [&] {
+            for (size_t i = 0; i < nOps; i++) {
+                sum += sas.template readValue<uint64_t>(static_cast<uint32_t>(0x10000000 + i * 4096));
+            }
+        });
+        std::printf("%-64s %12zu segments\n", "  after probing", sas.segments().size());
+        if (sum != 0) {
+            std::printf("unexpected sum\n");
+        }
+    }
+}
+
+template <typename SAS>
+static void benchAll(const std::string& backend) {
+    benchFragmented<SAS>(backend);
+    benchInsertSegments<SAS>(backend);
+    benchBulk<SAS>(backend);
+    benchValues<SAS>(backend);
+    benchLookupCache<SAS>(backend);
+    benchProbe<SAS>(backend);
+    benchReset<SAS>(backend);
+    benchSnapshot<SAS>(backend);
+}
+
+static void benchJournal() {
+    // One 64-bit write per step into a 1 MiB segment, with and without journaling
+    constexpr size_t nBytes = 1 << 20;
+    constexpr size_t nOps = nBytes / sizeof(uint64_t);
+    std::vector<uint8_t> init(nBytes, 0);
+
+    IntervalSAS plain;
+    plain.insertSegment(0, init);
+    benchmark("[journal] 64-bit writeValue, no journal", nOps, [&] {
+        for (size_t i = 0; i < nBytes; i += sizeof(uint64_t)) {
+            plain.writeValue(static_cast<uint32_t>(i), static_cast<uint64_t>(i));
+        }
+    });
+
+    JournaledSAS journaled;
+    journaled.insertSegment(0, init);
+    journaled.journal().setCapacity(8 << 20);
+    benchmark("[journal] 64-bit writeValue, undo journal", nOps, [&] {
+        for (size_t i = 0; i < nBytes; i += sizeof(uint64_t)) {
+            journaled.journal().setStep(i);
+            journaled.writeValue(static_cast<uint32_t>(i), static_cast<uint64_t>(i));
+        }
+    });
+    benchmark("[journal] rewind 64-bit writes", nOps, [&] { journaled.rewindTo(0); });
+}
+
+static void benchConcurrent() {
+    // Each thread reads 64-bit values from a shared 16 MiB region and writes to its own 1 MiB region, with a write for
+    // every 8 reads. Ideal scaling keeps the time per operation constant as threads are added.
+    using CSAS = ConcurrentSparseAddressSpace<uint64_t>;
+    constexpr size_t sharedBytes = 16 << 20;
+    constexpr size_t privateBytes = 1 << 20;
+    constexpr size_t opsPerThread = 1 << 22;
+    CSAS sas;
+    for (size_t i = 0; i < sharedBytes; i += 8) {
+        sas.writeValue(uint64_t(i), uint64_t(i));
+    }
+
+    const unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+        const std::string name = "[concurrent] mixed read/write, " + std::to_string(nThreads) + " threads";
+        benchmark(name, opsPerThread, [&] {
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < nThreads; t++) {
+                threads.emplace_back([&, t] {
+                    const uint64_t own = 0x100000000 + uint64_t(t) * privateBytes;
+                    uint64_t sum = 0;
+                    for (size_t i = 0; i < opsPerThread; i++) {
+                        if (i % 8 == 0) {
+                            sas.writeValue(own + (i * 8) % privateBytes, sum);
+                        } else {
+                            sum += sas.readValue<uint64_t>(((i * 7919 + t * 4096) * 8) % sharedBytes);
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        });
+
+        // Each thread increments its own counter, as well as a counter shared by all threads through LR/SC
+        const std::string amoName = "[concurrent] atomicFetchAdd + LR/SC, " + std::to_string(nThreads) + " threads";
+        benchmark(amoName, opsPerThread, [&] {
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < nThreads; t++) {
+                threads.emplace_back([&, t] {
+                    const uint64_t own = 0x100000000 + uint64_t(t) * privateBytes;
+                    for (size_t i = 0; i < opsPerThread; i += 2) {
+                        sas.atomicFetchAdd<uint64_t>(own, 1);
+                        uint64_t v;
+                        do {
+                            v = sas.loadReserved<uint64_t>(0x200000000, t);
+                        } while (!sas.storeConditional<uint64_t>(0x200000000, v + 1, t));
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        });
+    }
+}
+
+/**
+ * @brief benchSharded
+ * Each thread accesses its own 1 MiB region, placed in a separate shard for each thread. With a single shard, all
+ * threads contend on the same lock.
+ */
+template <unsigned NShards>
+static void benchSharded() {
+    using SSAS = ShardedSparseAddressSpace<uint32_t, NShards>;
+    constexpr size_t regionBytes = 1 << 20;
+    constexpr size_t opsPerThread = 1 << 20;
+    SSAS sas;
+    for (uint32_t t = 0; t < 16; t++) {
+        sas.insertSegment(t << 28, std::vector<uint8_t>(regionBytes, 0));
+    }
+
+    const unsigned maxThreads = std::max(1u, std::min(16u, std::thread::hardware_concurrency()));
+    for (unsigned nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+        const std::string name = "[sharded] " + std::to_string(NShards) + " shards, " + std::to_string(nThreads) +
+                                 " threads, 64-bit read/write";
+        benchmark(name, opsPerThread, [&] {
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < nThreads; t++) {
+                threads.emplace_back([&, t] {
+                    const uint32_t base = static_cast<uint32_t>(uint64_t(t) << 28);
+                    for (size_t i = 0; i < opsPerThread; i++) {
+                        const uint32_t addr = base + static_cast<uint32_t>((i * 8) % regionBytes);
+                        if (i % 2) {
+                            sas.writeValue(addr, uint64_t(i));
+                        } else {
+                            (void)sas.template readValue<uint64_t>(addr);
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        });
+    }
+}
+
+/**
+ * @brief benchElf
+ * Loads a 64 MiB ELF32 image of 64 segments, through the ELF loader and through the common pattern of copying each
+ * segment into a vector before inserting it.
+ */
+static void benchElf() {
+    constexpr size_t nSegments = 64;
+    constexpr size_t segSize = 1 << 20;
+    constexpr size_t headers = 52 + nSegments * 32;
+    std::vector<uint8_t> file(headers + nSegments * segSize, 0xAB);
+    auto put = [&](size_t offset, uint32_t value, unsigned n) {
+        for (unsigned i = 0; i < n; i++) {
+            file[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    };
+    std::memcpy(file.data(), "\x7f""ELF\x01\x01\x01", 7);
+    put(28, 52, 4);
+    put(42, 32, 2);
+    put(44, nSegments, 2);
+    for (size_t i = 0; i < nSegments; i++) {
+        const size_t ph = 52 + i * 32;
+        put(ph, 1, 4);
+        put(ph + 4, static_cast<uint32_t>(headers + i * segSize), 4);
+        put(ph + 8, static_cast<uint32_t>(i * 2 * segSize), 4);
+        put(ph + 16, segSize, 4);
+        put(ph + 20, segSize, 4);
+    }
+    const std::string path = "sas_bench.elf";
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+
+    benchmark("[elf] 64 MiB, 64 segments, copied into vectors", nSegments, [&] {
+        IntervalSAS sas;
+        std::ifstream in(path, std::ios::binary);
+        std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        for (size_t i = 0; i < nSegments; i++) {
+            const auto begin = contents.begin() + headers + i * segSize;
+            sas.getInitSas().insertSegment(static_cast<uint32_t>(i * 2 * segSize),
+                                           std::vector<uint8_t>(begin, begin + segSize));
+        }
+    });
+    benchmark("[elf] 64 MiB, 64 segments, ElfLoader", nSegments, [&] {
+        IntervalSAS sas;
+        ElfLoader::load(sas.getInitSas(), path);
+    });
+    std::remove(path.c_str());
+}
+
+/**
+ * @brief benchFile
+ * Inserts a 1 GiB sparse file as a file-backed segment and reads one byte of every 64th page, compared with copying
+ * 64 MiB of the file into a vector before inserting it.
+ */
+static void benchFile() {
+    constexpr size_t fileSize = size_t(1) << 30;
+    constexpr size_t copySize = size_t(64) << 20;
+    const std::string path = "sas_bench.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.seekp(fileSize - 1);
+        out.put(1);
+    }
+
+    benchmark("[file] 64 MiB, copied into a vector", 1, [&] {
+        IntervalSAS sas;
+        std::vector<uint8_t> contents(copySize);
+        std::ifstream(path, std::ios::binary).read(reinterpret_cast<char*>(contents.data()), copySize);
+        sas.insertSegment(0, std::move(contents));
+    });
+    IntervalSAS sas;
+    benchmark("[file] 1 GiB, insertFile", 1, [&] { sas.insertFile(0, path); });
+    unsigned sum = 0;
+    benchmark("[file] 1 GiB, read every 64th page", fileSize / (64 * 4096), [&] {
+        for (size_t address = 0; address < fileSize; address += 64 * 4096) {
+            sum += sas.readByte(static_cast<uint32_t>(address));
+        }
+    });
+    sas.clear();
+    std::remove(path.c_str());
+    if (sum != 0) {
+        std::printf("unexpected sum %u\n", sum);
+    }
+}
+
+/**
+ * @brief benchGrowth
+ * Writes sequential, descending, strided and random traces to an unmapped address space with the growth policy
+ * T_growth, and reports the number of segments created by each trace.
+ */
+template <typename T_growth>
+static void benchGrowth(const std::string& policy) {
+    using SAS = SparseAddressSpace<uint32_t, IntervalStorage<uint32_t, T_growth>>;
+    constexpr size_t nOps = 256 << 10;
+    const std::string name = "[growth: " + policy + "] ";
+    auto run = [&](const std::string& trace, const std::function<void(SAS&)>& fn) {
+        // Untimed first run, such that no trace pays for the allocator consolidating the segments freed by the
+        // previous trace
+        {
+            SAS warmup;
+            fn(warmup);
+        }
+        SAS sas;
+        benchmark(name + trace, nOps, [&] { fn(sas); });
+        std::printf("%-64s %12zu segments\n", "  after writing", sas.segments().size());
+    };
+
+    run("sequential writeByte", [&](SAS& sas) {
+        for (size_t i = 0; i < nOps; i++) {
+            sas.writeByte(static_cast<uint32_t>(0x10000000 + i), 1);
+        }
+    });
+    run("descending writeByte", [&](SAS& sas) {
+        for (size_t i = 0; i < nOps; i++) {
+            sas.writeByte(static_cast<uint32_t>(0x10000000 - i), 1);
+        }
+    });
+    run("strided writeValue<uint32_t>, 64-byte stride", [&](SAS& sas) {
+        for (size_t i = 0; i < nOps; i++) {
+            sas.template writeValue<uint32_t>(static_cast<uint32_t>(0x10000000 + i * 64), 1);
+        }
+    });
+    run("random writeByte in 64 MiB", [&](SAS& sas) {
+        uint32_t x = 1;
+        for (size_t i = 0; i < nOps; i++) {
+            x = x * 1664525 + 1013904223;
+            sas.writeByte(0x10000000 + (x >> 6), 1);
+        }
+    });
+}
+
+/**
+ * @brief benchMaxSegmentSize
+ * Compares unbounded segments with a maximum segment size of 64 KiB on writes after resetting from a 16 MiB
+ * initialization segment, which copy the written segment, and on random 4 KiB inserts filling a 16 MiB region, which
+ * coalesce with the growing segments around them.
+ */
+static void benchMaxSegmentSize() {
+    constexpr size_t regionSize = 16 << 20;
+    for (const size_t maxSize : {size_t(0), size_t(64) << 10}) {
+        const std::string name =
+            std::string("[interval] [max segment size ") + (maxSize == 0 ? "unbounded" : "64 KiB") + "] ";
+        uint32_t x = 1;
+        auto random = [&] {
+            x = x * 1664525 + 1013904223;
+            return x >> 8;
+        };
+
+        IntervalSAS sas;
+        sas.setMaxSegmentSize(maxSize);
+        sas.getInitSas().insertSegment(0, std::vector<uint8_t>(regionSize, 0));
+        constexpr size_t nResets = 256;
+        benchmark(name + "reset + random writeByte", nResets, [&] {
+            for (size_t i = 0; i < nResets; i++) {
+                sas.reset();
+                sas.writeByte(random() % regionSize, 1);
+            }
+        });
+
+        IntervalSAS inserts;
+        inserts.setMaxSegmentSize(maxSize);
+        constexpr size_t nInserts = 8192;
+        benchmark(name + "random 4 KiB insertSegment in 16 MiB", nInserts, [&] {
+            for (size_t i = 0; i < nInserts; i++) {
+                inserts.insertSegment(random() % regionSize, std::vector<uint8_t>(4096, 1));
+            }
+        });
+        std::printf("%-64s %12zu segments\n", "  after inserting", inserts.segments().size());
+    }
+}
+
+/**
+ * @brief benchCoalescing
+ * Compares eager and deferred coalescing on a burst of random 256-byte inserts filling a 16 MiB region, on descending
+ * writeByte, as by a growing stack, and on resets followed by writes next to 1 MiB initialization segments, which are
+ * shared copy-on-write with the initialization SAS. Deferred coalescing is compacted automatically at the default
+ * threshold, or once at the end of each burst. The segments of the first two traces hold private bytes, which deferred
+ * coalescing coalesces eagerly, such that only the last trace differs between the modes.
+ */
+static void benchCoalescing() {
+    constexpr size_t regionSize = 16 << 20;
+    constexpr size_t nInserts = 1 << 16;
+    constexpr size_t nWrites = 256 << 10;
+    struct Mode {
+        const char* name;
+        SASCoalescing coalescing;
+        double threshold;
+    };
+    for (const Mode& mode :
+         {Mode{"eager", SASCoalescing::Eager, 0}, Mode{"defer shared", SASCoalescing::DeferShared, 0.5},
+          Mode{"deferred", SASCoalescing::Deferred, 0.5},
+          Mode{"deferred, compact at end", SASCoalescing::Deferred, 0}}) {
+        const std::string name = std::string("[interval] [coalescing: ") + mode.name + "] ";
+        uint32_t x = 1;
+        IntervalSAS inserts;
+        inserts.setCoalescing(mode.coalescing, mode.threshold);
+        benchmark(name + "random 256 B insertSegment in 16 MiB", nInserts, [&] {
+            for (size_t i = 0; i < nInserts; i++) {
+                x = x * 1664525 + 1013904223;
+                inserts.insertSegment((x >> 8) % regionSize, std::vector<uint8_t>(256, 1));
+            }
+            inserts.compact();
+        });
+        std::printf("%-64s %12zu segments\n", "  after compacting", inserts.segments().size());
+
+        IntervalSAS stack;
+        stack.setCoalescing(mode.coalescing, mode.threshold);
+        benchmark(name + "descending writeByte", nWrites, [&] {
+            for (size_t i = 0; i < nWrites; i++) {
+                stack.writeByte(static_cast<uint32_t>(0x80000000 - i), 1);
+            }
+            stack.compact();
+        });
+
+        IntervalSAS job;
+        job.setCoalescing(mode.coalescing, mode.threshold);
+        for (uint32_t i = 0; i < 64; i++) {
+            job.getInitSas().insertSegment(i << 21, std::vector<uint8_t>(1 << 20, 0));
+        }
+        constexpr size_t nResets = 1024;
+        benchmark(name + "reset + 8 writes next to 1 MiB init segments", nResets, [&] {
+            for (size_t i = 0; i < nResets; i++) {
+                job.reset();
+                for (unsigned j = 0; j < 8; j++) {
+                    x = x * 1664525 + 1013904223;
+                    job.writeByte(((x >> 8) % 64) << 21 | 1 << 20, 1);
+                }
+            }
+        });
+    }
+}
+
+/**
+ * @brief benchSnapshotFile
+ * Saves an address space of 4096 segments of 16 KiB to a snapshot file, loads it, and reads every byte of it, with
+ * and without compression. Segments are half zeros and half a repeating pattern.
+ */
+template <typename SAS>
+static void benchSnapshotFile(const std::string& backend) {
+    constexpr size_t nSegments = 4096;
+    constexpr size_t segSize = 16 << 10;
+    const std::string path = "sas_bench.snap";
+    SAS sas;
+    for (size_t i = 0; i < nSegments; i++) {
+        std::vector<uint8_t> bytes(segSize, 0);
+        for (size_t j = segSize / 2; j < segSize; j++) {
+            bytes[j] = static_cast<uint8_t>(i + j % 13);
+        }
+        sas.insertSegment(static_cast<uint32_t>(i * 2 * segSize), std::move(bytes));
+    }
+
+    uint64_t sum = 0;
+    for (const bool compressed : {false, true}) {
+        const std::string name = backend + (compressed ? "[compressed snapshot file] " : "[snapshot file] ");
+        benchmark(name + "save 4096 x 16 KiB", nSegments, [&] { sas.save(path, compressed); });
+        SAS loaded;
+        benchmark(name + "load 4096 x 16 KiB", nSegments, [&] { loaded.load(path); });
+        benchmark(name + "read all loaded bytes", nSegments * segSize / 8, [&] {
+            for (size_t i = 0; i < nSegments; i++) {
+                for (size_t offset = 0; offset < segSize; offset += 8) {
+                    sum += loaded.template readValue<uint64_t>(static_cast<uint32_t>(i * 2 * segSize + offset));
+                }
+            }
+        });
+        std::printf("%-64s %12zu bytes\n", (name + "file size").c_str(),
+                    static_cast<size_t>(std::ifstream(path, std::ios::binary | std::ios::ate).tellg()));
+    }
+    std::remove(path.c_str());
+    if (sum == 0) {
+        std::printf("unexpected sum\n");
+    }
+}
+
+int main() {
+    benchAll<IntervalSAS>("[interval] ");
+    benchAll<PageTableSAS>("[pagetable] ");
+    benchJournal();
+    benchConcurrent();
+    benchSharded<1>();
+    benchSharded<16>();
+    benchElf();
+    benchFile();
+    benchSnapshotFile<IntervalSAS>("[interval] ");
+    benchSnapshotFile<PageTableSAS>("[pagetable] ");
+    benchGrowth<CenteredGrowth>("centered");
+    benchGrowth<StrideGrowth>("stride");
+    benchGrowth<GeometricGrowth<>>("geometric");
+    benchGrowth<PageAlignedGrowth<>>("page aligned");
+    benchMaxSegmentSize();
+    benchCoalescing();
+    return 0;
+}
@@ -1,8 +1,15 @@
 #define CATCH_CONFIG_MAIN
 #include "external/Catch2/single_include/catch2/catch.hpp"
 
+#include <atomic>
+#include <cstdio>
+#include <fstream>
 #include <numeric>
+#include <thread>
 
+#include "ConcurrentSparseAddressSpace.h"
+#include "ElfLoader.h"
+#include "ShardedSparseAddressSpace.h"
 #include "SparseAddressSpace.h"
 
 static constexpr int s_minsegsize = 5;
@@ -122,6 +129,23 @@ TEST_CASE("Test top") {
 
             verifySegment(seg, s2_start, {{s2_val, s1_size}, {s1_val, s1_size}, {s3_val, s1_size}});
         }
+
+        SECTION("Bridging coalescing") {
+            // s2 and s3 are separated from s1 by gaps. s4 spans from within s2, across s1, and into s3, such that all
+            // four segments must be coalesced into a single segment.
+            const uint32_t s2_start = s1_start - 2 * s1_size;
+            addSegment(sas, s2_start, s1_size, s2_val);
+            const uint32_t s3_start = s1_start + 2 * s1_size;
+            addSegment(sas, s3_start, s1_size, s3_val);
+            REQUIRE(sas.segments().size() == 3);
+
+            const uint32_t s4_start = s2_start + s1_size / 2;
+            const int s4_size = 4 * s1_size;
+            addSegment(sas, s4_start, s4_size, 4);
+
+            auto seg = getExpectedSingleSegment(sas);
+            verifySegment(seg, s2_start, {{s2_val, s1_size / 2}, {4, s4_size}, {s3_val, s1_size / 2}});
+        }
     }
 
     SECTION("Read/write initialized") {
@@ -150,6 +174,17 @@ TEST_CASE("Test top") {
                            {((deadbeef >> 24) & 0xFF), 1},
                            {s1_val, static_cast<int>(s1_size / 2 - sizeof(deadbeef))}});
         }
+
+        SECTION("Read/write value across segment boundary") {
+            // A 64-bit value written across the end of s1 spills into a newly created segment, which is coalesced
+            // with s1
+            const uint64_t value = 0x0123456789ABCDEFull;
+            const uint32_t addr = s1_start + s1_size - 3;
+            sas.writeValue(addr, value);
+            REQUIRE(sas.readValue<uint64_t>(addr) == value);
+            REQUIRE(sas.readValue<uint32_t>(addr + 4) == static_cast<uint32_t>(value >> 32));
+            getExpectedSingleSegment(sas);
+        }
     }
 
     SECTION("Read/write uninitialized") {
@@ -249,6 +284,1837 @@ TEST_CASE("Initialization test") {
     verifySegment(seg2, s2_start, {{s2_val, s2_size}});
 }
 
+TEST_CASE("Bulk access") {
+    static constexpr int s1_val = 1;
+    static constexpr int s1_size = 10;
+    static constexpr int s1_start = 100;
+    static constexpr int s2_val = 2;
+    static constexpr int s2_start = s1_start + 2 * s1_size;
+
+    SAS sas(s_minsegsize);
+    addSegment(sas, s1_start, s1_size, s1_val);
+    addSegment(sas, s2_start, s1_size, s2_val);
+
+    SECTION("Read across segments and gaps") {
+        // Read from before s1 until after s2. Gaps read as zero and do not create segments.
+        const uint32_t start = s1_start - s1_size;
+        std::vector<uint8_t> buf(5 * s1_size, 0xFF);
+        sas.readBytes(start, buf.data(), buf.size());
+        REQUIRE(sas.segments().size() == 2);
+
+        std::vector<uint8_t> expected;
+        for (int v : {0, s1_val, 0, s2_val, 0}) {
+            expected.insert(expected.end(), s1_size, v);
+        }
+        REQUIRE(buf == expected);
+    }
+
+    SECTION("Write within segment") {
+        const std::vector<uint8_t> src = {3, 4, 5};
+        sas.writeBytes(s1_start + 1, src.data(), src.size());
+        REQUIRE(sas.segments().size() == 2);
+        verifySegment(getSegmentAtAddr(sas, s1_start), s1_start,
+                      {{s1_val, 1}, {3, 1}, {4, 1}, {5, 1}, {s1_val, s1_size - 4}});
+    }
+
+    SECTION("Write across gaps") {
+        // A write spanning from before s1 until within s2 creates a single covering segment, coalesced with s2
+        const uint32_t start = s1_start - s1_size;
+        const std::vector<uint8_t> src(3 * s1_size + s1_size / 2, 3);
+        sas.writeBytes(start, src.data(), src.size());
+
+        auto seg = getExpectedSingleSegment(sas);
+        verifySegment(seg, start, {{3, static_cast<int>(src.size())}, {s2_val, s1_size / 2}});
+
+        std::vector<uint8_t> buf(src.size());
+        sas.readBytes(start, buf.data(), buf.size());
+        REQUIRE(buf == src);
+    }
+
+    SECTION("Out of bounds") {
+        uint8_t buf[2];
+        REQUIRE_THROWS(sas.readBytes(std::numeric_limits<uint32_t>::max(), buf, 2));
+        REQUIRE_THROWS(sas.writeBytes(std::numeric_limits<uint32_t>::max(), buf, 2));
+    }
+}
+
+TEST_CASE("Lookup cache") {
+    // Code, stack and heap-like regions, far apart in the address space
+    const std::vector<uint32_t> regions = {0x1000, 0x7FFF0000, 0x10000000};
+
+    SAS sas(s_minsegsize, 4);
+    for (uint32_t r : regions) {
+        addSegment(sas, r, 0x100, 1);
+    }
+
+    SECTION("Alternating regions hit") {
+        for (uint32_t r : regions) {
+            sas.readByte(r);
+        }
+        sas.resetTLBStats();
+        for (int i = 0; i < 10; i++) {
+            for (uint32_t r : regions) {
+                sas.readByte(r + i);
+            }
+        }
+        REQUIRE(sas.tlbStats().misses == 0);
+        REQUIRE(sas.tlbStats().hits == 30);
+        REQUIRE(sas.tlbStats().hitRate() == 1.0);
+    }
+
+    SECTION("Invalidation on coalescing") {
+        // Cache the segments at regions[0], then overwrite and extend it through coalescing
+        REQUIRE(sas.readByte(regions[0]) == 1);
+        addSegment(sas, regions[0] - 0x10, 0x20, 2);
+        REQUIRE(sas.readByte(regions[0]) == 2);
+        REQUIRE(sas.readByte(regions[0] - 0x10) == 2);
+        REQUIRE(sas.readByte(regions[0] + 0x10) == 1);
+    }
+
+    SECTION("Invalidation on clear") {
+        REQUIRE(sas.readByte(regions[1]) == 1);
+        sas.clear();
+        REQUIRE(sas.readByte(regions[1]) == 0);
+    }
+}
+
+TEST_CASE("Segment ownership") {
+    SAS sas(s_minsegsize);
+    auto s1 = createSegment(10, 10, 1);
+    sas.insertSegment(*s1);
+
+    // The inserted segment is copied into the address space; coalescing does not modify the original segment
+    addSegment(sas, 15, 10, 2);
+    verifySegment(s1, 10, {{1, 10}});
+    REQUIRE(s1->data.size() == 10);
+
+    // Segments handed out by segments() stay valid until the address space is cleared
+    auto seg = getExpectedSingleSegment(sas);
+    verifySegment(seg, 10, {{1, 5}, {2, 10}});
+    REQUIRE(sas.contains(20) == seg.lock().get());
+    sas.clear();
+    REQUIRE(seg.expired());
+    REQUIRE(!sas.contains(20));
+
+    // Pointers to segments expire once they are coalesced into other segments, even though their memory is recycled
+    // for new segments
+    addSegment(sas, 100, 10, 3);
+    addSegment(sas, 200, 10, 4);
+    const auto segs = sas.segments();
+    REQUIRE(segs.size() == 2);
+    const auto locked = segs[1].lock();
+    REQUIRE(!segs[0].expired());
+    addSegment(sas, 90, 130, 5);
+    REQUIRE(segs[0].expired());
+    for (uint32_t a = 0x1000; a < 0x10000; a += 0x100) {
+        addSegment(sas, a, 10, 6);
+    }
+    REQUIRE(segs[0].expired());
+    // A locked pointer keeps the memory of the segment alive, but is no longer shared with the address space
+    REQUIRE(locked.use_count() == 1);
+}
+
+TEST_CASE("64-bit address space") {
+    using SAS64 = SparseAddressSpace<uint64_t>;
+    constexpr uint64_t top = std::numeric_limits<uint64_t>::max();
+    SAS64 sas(s_minsegsize);
+
+    SECTION("Top of address space") {
+        // Segments created at the top of the address space are truncated within the address space
+        sas.writeByte(top, 1);
+        auto segs = sas.segments();
+        REQUIRE(segs.size() == 1);
+        REQUIRE(segs[0].lock()->start == top - s_minsegsize / 2);
+        REQUIRE(segs[0].lock()->end() == top);
+        REQUIRE(sas.readByte(top) == 1);
+
+        // Adjacent segment below is coalesced with the segment at the top of the address space
+        sas.insertSegment(top - 10, std::vector<uint8_t>(9, 2));
+        segs = sas.segments();
+        REQUIRE(segs.size() == 1);
+        REQUIRE(segs[0].lock()->start == top - 10);
+        REQUIRE(sas.readByte(top - 10) == 2);
+        REQUIRE(sas.readByte(top) == 1);
+    }
+
+    SECTION("Bottom of address space") {
+        // Segments created at the bottom of the address space are shifted upwards
+        sas.writeByte(0, 1);
+        auto segs = sas.segments();
+        REQUIRE(segs.size() == 1);
+        REQUIRE(segs[0].lock()->start == 0);
+        REQUIRE(segs[0].lock()->data.size() == s_minsegsize);
+    }
+
+    SECTION("High addresses are not truncated") {
+        const uint64_t addr = 0xFFFF'FFFF'0000'0000ull;
+        const uint64_t value = 0xDEAD'BEEF'CAFE'F00Dull;
+        sas.writeValue(addr, value);
+        REQUIRE(sas.readValue<uint64_t>(addr) == value);
+        REQUIRE(sas.contains(addr));
+        REQUIRE(!sas.contains(addr & 0xFFFF'FFFFull));
+
+        // Spans up to and including the last byte of the address space
+        std::vector<uint8_t> buf(16, 3);
+        sas.writeBytes(top - 15, buf.data(), buf.size());
+        std::vector<uint8_t> rd(16);
+        sas.readBytes(top - 15, rd.data(), rd.size());
+        REQUIRE(rd == buf);
+        REQUIRE_THROWS(sas.writeBytes(top - 14, buf.data(), buf.size()));
+    }
+}
+
+TEST_CASE("Page table storage") {
+    using PSAS = SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>;
+    constexpr uint32_t pageSize = 4096;
+    PSAS sas;
+
+    SECTION("Pages are created on access") {
+        sas.writeByte(3 * pageSize + 5, 1);
+        auto segs = sas.segments();
+        REQUIRE(segs.size() == 1);
+        REQUIRE(segs[0].lock()->start == 3 * pageSize);
+        REQUIRE(segs[0].lock()->data.size() == pageSize);
+        REQUIRE(sas.readByte(3 * pageSize + 5) == 1);
+        REQUIRE(sas.readByte(3 * pageSize + 6) == 0);
+    }
+
+    SECTION("Segments are split into pages") {
+        const uint32_t start = pageSize - 10;
+        sas.insertSegment(start, std::vector<uint8_t>(2 * pageSize, 1));
+        sas.insertSegment(start + 5, std::vector<uint8_t>(10, 2));
+        REQUIRE(sas.segments().size() == 3);
+        for (const auto& seg : sas.segments()) {
+            REQUIRE(seg.lock()->start % pageSize == 0);
+        }
+
+        std::vector<uint8_t> buf(2 * pageSize + 20);
+        sas.readBytes(start - 10, buf.data(), buf.size());
+        std::vector<uint8_t> expected(10, 0);
+        expected.insert(expected.end(), 5, 1);
+        expected.insert(expected.end(), 10, 2);
+        expected.insert(expected.end(), 2 * pageSize - 15, 1);
+        expected.insert(expected.end(), 10, 0);
+        REQUIRE(buf == expected);
+    }
+
+    SECTION("Reads across unallocated pages") {
+        sas.writeValue(0x10000000u, uint32_t(0xDEADBEEF));
+        std::vector<uint8_t> buf(0x100000, 0xFF);
+        sas.readBytes(0x10000000u - 0x80000, buf.data(), buf.size());
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(buf[0x80000] == 0xEF);
+        REQUIRE(std::count(buf.begin(), buf.end(), 0) == static_cast<long>(buf.size() - 4));
+    }
+
+    SECTION("Reset") {
+        sas.getInitSas().insertSegment(100, std::vector<uint8_t>(10, 1));
+        sas.reset();
+        sas.writeByte(105, 2);
+        sas.writeByte(0x80000000u, 3);
+        REQUIRE(sas.segments().size() == 2);
+        sas.reset();
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(sas.readByte(105) == 1);
+    }
+
+    SECTION("64-bit") {
+        SparseAddressSpace<uint64_t, PageTableStorage<uint64_t>> sas64;
+        constexpr uint64_t top = std::numeric_limits<uint64_t>::max();
+        sas64.writeValue(top - 3, uint32_t(0x01020304));
+        REQUIRE(sas64.readValue<uint32_t>(top - 3) == 0x01020304);
+        auto segs = sas64.segments();
+        REQUIRE(segs.size() == 1);
+        REQUIRE(segs[0].lock()->end() == top);
+    }
+}
+
+TEST_CASE("Copy-on-write reset") {
+    SAS sas(s_minsegsize);
+    sas.getInitSas().insertSegment(10, std::vector<uint8_t>(10, 1));
+    sas.getInitSas().insertSegment(100, std::vector<uint8_t>(10, 2));
+    sas.reset();
+
+    // Segments share their bytes with the initialization SAS until written
+    const uint8_t* initBytes = sas.getInitSas().contains(10)->data.data();
+    REQUIRE(sas.contains(10)->data.data() == initBytes);
+    REQUIRE(sas.contains(10)->data.isShared());
+
+    sas.writeByte(15, 3);
+    REQUIRE(sas.contains(10)->data.data() != initBytes);
+    REQUIRE(sas.readByte(15) == 3);
+    REQUIRE(sas.getInitSas().readByte(15) == 1);
+
+    // The unwritten segment is still shared
+    REQUIRE(sas.contains(100)->data.data() == sas.getInitSas().contains(100)->data.data());
+
+    sas.reset();
+    REQUIRE(sas.readByte(15) == 1);
+    REQUIRE(sas.contains(10)->data.data() == initBytes);
+}
+
+TEST_CASE("Segment extension") {
+    SECTION("Headroom") {
+        // Extending segment data byte by byte reallocates its buffer a logarithmic number of times
+        for (const bool front : {true, false}) {
+            SASSegmentData bytes(1, 0);
+            unsigned reallocations = 0;
+            for (unsigned i = 1; i < 0x10000; i++) {
+                const uint8_t value = static_cast<uint8_t>(i);
+                const size_t capacity = bytes.capacity();
+                if (front) {
+                    bytes.prepend(&value, 1);
+                } else {
+                    bytes.append(&value, 1);
+                }
+                reallocations += bytes.capacity() != capacity;
+            }
+            REQUIRE(reallocations <= 17);
+            REQUIRE(bytes.size() == 0x10000);
+            for (unsigned i = 0; i < 0x10000; i++) {
+                REQUIRE(bytes[front ? 0xFFFF - i : i] == static_cast<uint8_t>(i));
+            }
+        }
+    }
+
+    SECTION("Shared headroom") {
+        // Copies and slices never write into headroom of a buffer which they share
+        SASSegmentData bytes(16, 1);
+        const uint8_t value = 2;
+        bytes.append(&value, 1);
+        SASSegmentData copy = bytes;
+        SASSegmentData head = bytes.slice(0, 8);
+        copy.append(&value, 1);
+        copy.prepend(&value, 1);
+        head.append(&value, 1);
+        REQUIRE(bytes.size() == 17);
+        REQUIRE(bytes[0] == 1);
+        REQUIRE(bytes[16] == 2);
+        REQUIRE(copy.size() == 19);
+        REQUIRE(head.size() == 9);
+        REQUIRE(head[8] == 2);
+        REQUIRE(bytes[8] == 1);
+    }
+
+    SECTION("Address space") {
+        // Descending and ascending byte writes grow a single segment
+        SAS sas(s_minsegsize);
+        sas.getInitSas().insertSegment(0x8000, std::vector<uint8_t>(16, 1));
+        sas.reset();
+        for (uint32_t i = 1; i <= 0x4000; i++) {
+            sas.writeByte(0x8000 - i, static_cast<uint8_t>(i));
+            sas.writeByte(0x800F + i, static_cast<uint8_t>(i * 3));
+        }
+        REQUIRE(sas.segments().size() == 1);
+        for (uint32_t i = 1; i <= 0x4000; i++) {
+            REQUIRE(sas.readByte(0x8000 - i) == static_cast<uint8_t>(i));
+            REQUIRE(sas.readByte(0x800F + i) == static_cast<uint8_t>(i * 3));
+        }
+        REQUIRE(sas.readByte(0x8000) == 1);
+
+        // The initialization SAS is unaffected
+        REQUIRE(sas.getInitSas().segments().size() == 1);
+        REQUIRE(sas.getInitSas().contains(0x8000)->data.size() == 16);
+    }
+}
+
+TEMPLATE_TEST_CASE("Bulk insertion", "", SAS, (SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>)) {
+    using Segment = typename TestType::Segment;
+    auto segment = [](uint32_t start, size_t size, uint8_t value) {
+        Segment seg;
+        seg.start = start;
+        seg.data = std::vector<uint8_t>(size, value);
+        return seg;
+    };
+
+    SECTION("Later segments win") {
+        TestType sas(s_minsegsize);
+        sas.insertSegment(0x10, std::vector<uint8_t>(0x10, 9));
+        std::vector<Segment> segs = {segment(0x40, 0x10, 1), segment(0x00, 0x18, 2), segment(0x44, 0x4, 3),
+                                     segment(0x50, 0x4, 4), segment(0x3C, 0x8, 5), segment(0x1000, 0x10, 6)};
+        sas.insertSegments(segs.begin(), segs.end());
+
+        REQUIRE(sas.readByte(0x00) == 2);
+        REQUIRE(sas.readByte(0x17) == 2);
+        REQUIRE(sas.readByte(0x18) == 9);
+        REQUIRE(sas.readByte(0x3C) == 5);
+        REQUIRE(sas.readByte(0x43) == 5);
+        REQUIRE(sas.readByte(0x44) == 3);
+        REQUIRE(sas.readByte(0x48) == 1);
+        REQUIRE(sas.readByte(0x53) == 4);
+        REQUIRE(sas.readByte(0x1000) == 6);
+        if (std::is_same<TestType, SAS>::value) {
+            REQUIRE(sas.segments().size() == 3);
+
+            // Isolated segments are adopted without copying their bytes
+            REQUIRE(sas.contains(0x1000)->data.data() == segs.back().data.data());
+        }
+    }
+
+    SECTION("Equivalent to sequential insertion") {
+        TestType bulk(s_minsegsize);
+        TestType sequential(s_minsegsize);
+        for (uint32_t i = 0; i < 16; i++) {
+            bulk.insertSegment(i * 0x100, std::vector<uint8_t>(0x20, 0xFF));
+            sequential.insertSegment(i * 0x100, std::vector<uint8_t>(0x20, 0xFF));
+        }
+
+        std::vector<Segment> segs;
+        for (int i = 0; i < 200; i++) {
+            segs.push_back(segment(std::rand() % 0x1000, 1 + std::rand() % 0x40, static_cast<uint8_t>(i)));
+        }
+        bulk.insertSegments(segs.begin(), segs.end());
+        for (const Segment& seg : segs) {
+            sequential.insertSegment(seg);
+        }
+
+        std::vector<uint8_t> expected(0x1100), actual(0x1100);
+        sequential.readBytes(0, expected.data(), expected.size());
+        bulk.readBytes(0, actual.data(), actual.size());
+        REQUIRE(actual == expected);
+        REQUIRE(bulk.segments().size() == sequential.segments().size());
+    }
+}
+
+TEST_CASE("Maximum segment size") {
+    constexpr size_t maxSize = 0x100;
+    SAS sas(s_minsegsize);
+    sas.setMaxSegmentSize(maxSize);
+    // Segments are within the limit, and adjacent segments do not fit within the limit together
+    auto requireBounded = [&](const SAS& space) {
+        uint64_t next = 0;
+        size_t prevSize = 0;
+        for (const auto& seg : space.segments()) {
+            REQUIRE(seg.lock()->data.size() <= maxSize);
+            REQUIRE(seg.lock()->start >= next);
+            if (prevSize != 0 && seg.lock()->start == next) {
+                REQUIRE(prevSize + seg.lock()->data.size() > maxSize);
+            }
+            next = uint64_t(seg.lock()->end()) + 1;
+            prevSize = seg.lock()->data.size();
+        }
+    };
+
+    SECTION("Oversized inserts are split") {
+        std::vector<uint8_t> bytes(0x280);
+        std::iota(bytes.begin(), bytes.end(), 0);
+        const uint8_t* adopted = bytes.data();
+        sas.insertSegment(0x1000, std::move(bytes));
+        REQUIRE(sas.segments().size() == 3);
+        requireBounded(sas);
+        REQUIRE(sas.contains(0x1100)->start == 0x1100);
+        REQUIRE(sas.contains(0x1200)->data.size() == 0x80);
+        REQUIRE(sas.readByte(0x1234) == 0x34);
+
+        // The bytes are not copied, and each part may be written in place
+        REQUIRE(sas.contains(0x1100)->data.data() == adopted + 0x100);
+        sas.writeByte(0x1100, 0xAA);
+        REQUIRE(sas.contains(0x1100)->data.data() == adopted + 0x100);
+    }
+
+    SECTION("Coalescing stops at the limit") {
+        for (uint32_t a = 0x1000; a < 0x2000; a++) {
+            sas.writeByte(a, static_cast<uint8_t>(a));
+        }
+        for (uint32_t a = 0x3000; a > 0x2800; a--) {
+            sas.writeByte(a, static_cast<uint8_t>(a));
+        }
+        requireBounded(sas);
+        for (uint32_t a = 0x1000; a < 0x2000; a++) {
+            REQUIRE(sas.readByte(a) == static_cast<uint8_t>(a));
+        }
+        for (uint32_t a = 0x2801; a <= 0x3000; a++) {
+            REQUIRE(sas.readByte(a) == static_cast<uint8_t>(a));
+        }
+
+        // An insert overlapping full segments trims them rather than coalescing with them
+        sas.insertSegment(0x10F0, std::vector<uint8_t>(0x20, 0xEE));
+        requireBounded(sas);
+        REQUIRE(sas.readByte(0x10EF) == 0xEF);
+        REQUIRE(sas.readByte(0x10F0) == 0xEE);
+        REQUIRE(sas.readByte(0x110F) == 0xEE);
+        REQUIRE(sas.readByte(0x1110) == 0x10);
+
+        // Trimmed neighbors are coalesced again, such that repeated inserts into a fully touched region do not
+        // fragment it beyond twice its size divided by the limit
+        for (int i = 0; i < 1000; i++) {
+            const uint32_t address = 0x1000 + std::rand() % 0xF00;
+            sas.insertSegment(address, std::vector<uint8_t>(1 + std::rand() % 0x100, static_cast<uint8_t>(i)));
+        }
+        requireBounded(sas);
+        size_t count = 0;
+        for (const auto& seg : sas.segments()) {
+            count += seg.lock()->start < 0x2000;
+        }
+        REQUIRE(count <= 2 * 0x1000 / maxSize + 1);
+    }
+
+    SECTION("Equivalent to unbounded segments") {
+        SAS unbounded(s_minsegsize);
+        std::vector<SAS::Segment> bulk;
+        for (int i = 0; i < 2000; i++) {
+            const uint32_t address = std::rand() % 0x4000;
+            const uint8_t value = static_cast<uint8_t>(i);
+            switch (std::rand() % 3) {
+                case 0:
+                    sas.writeByte(address, value);
+                    unbounded.writeByte(address, value);
+                    break;
+                case 1: {
+                    std::vector<uint8_t> bytes(1 + std::rand() % 0x300, value);
+                    sas.insertSegment(address, bytes);
+                    unbounded.insertSegment(address, std::move(bytes));
+                    break;
+                }
+                default: {
+                    SAS::Segment seg;
+                    seg.start = address;
+                    seg.data = std::vector<uint8_t>(1 + std::rand() % 0x300, value);
+                    bulk.push_back(seg);
+                    if (bulk.size() == 16) {
+                        sas.insertSegments(bulk.begin(), bulk.end());
+                        unbounded.insertSegments(bulk.begin(), bulk.end());
+                        bulk.clear();
+                    }
+                }
+            }
+        }
+        requireBounded(sas);
+        std::vector<uint8_t> expected(0x4400), actual(0x4400);
+        unbounded.readBytes(0, expected.data(), expected.size());
+        sas.readBytes(0, actual.data(), actual.size());
+        REQUIRE(actual == expected);
+    }
+
+    SECTION("Existing segments") {
+        SAS unbounded(s_minsegsize);
+        unbounded.getInitSas().insertSegment(0, std::vector<uint8_t>(0x1000, 1));
+        unbounded.reset();
+        unbounded.insertSegment(0x2000, std::vector<uint8_t>(0x1000, 2));
+        auto snap = unbounded.snapshot();
+
+        // Limiting the segment size splits existing segments, including those of the initialization SAS
+        unbounded.setMaxSegmentSize(maxSize);
+        requireBounded(unbounded);
+        requireBounded(unbounded.getInitSas());
+        REQUIRE(unbounded.segments().size() == 0x20);
+        unbounded.reset();
+        requireBounded(unbounded);
+
+        // Snapshots of unbounded address spaces are split upon restoring them
+        sas.restore(snap);
+        requireBounded(sas);
+        REQUIRE(sas.readByte(0x2FFF) == 2);
+        requireBounded(sas.fork());
+    }
+
+    SECTION("Raising the limit") {
+        sas.insertSegment(0x1000, std::vector<uint8_t>(0x280, 1));
+        REQUIRE(sas.readByte(0x1010) == 1);
+        REQUIRE(sas.readByte(0x1110) == 1);
+
+        // Segments which fit within the raised limit together are coalesced, and cached segments are invalidated
+        sas.setMaxSegmentSize(2 * maxSize);
+        REQUIRE(sas.segments().size() == 2);
+        REQUIRE(sas.contains(0x1000)->data.size() == 2 * maxSize);
+        REQUIRE(sas.readByte(0x1010) == 1);
+        REQUIRE(sas.readByte(0x1110) == 1);
+        sas.setMaxSegmentSize(0);
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(sas.readByte(0x1210) == 1);
+    }
+
+    SECTION("Differing limit of the initialization SAS") {
+        // Resetting applies the limit of the SAS to the initialization SAS, whose segments are shared as they are
+        sas.getInitSas().setMaxSegmentSize(0);
+        sas.getInitSas().insertSegment(0, std::vector<uint8_t>(0x300, 1));
+        sas.reset();
+        requireBounded(sas);
+        requireBounded(sas.getInitSas());
+        REQUIRE(sas.readByte(0x10) == 1);
+
+        // Segments cached for the reads are not invalidated by a bulk insert elsewhere
+        std::vector<SAS::Segment> bulk(1);
+        bulk[0].start = 0x1000;
+        bulk[0].data = std::vector<uint8_t>(4, 2);
+        sas.insertSegments(bulk.begin(), bulk.end());
+        REQUIRE(sas.readByte(0x10) == 1);
+        REQUIRE(sas.readByte(0x1003) == 2);
+
+        // Empty segments, such as released pool slots, contain no address
+        REQUIRE_FALSE(SAS::Segment().contains(uint32_t(0)));
+    }
+}
+
+TEST_CASE("Deferred coalescing") {
+    const SASCoalescing deferral = GENERATE(SASCoalescing::DeferShared, SASCoalescing::Deferred);
+    SAS sas(s_minsegsize);
+    auto requireAdjacent = [](const SAS& space, bool adjacent) {
+        bool found = false;
+        uint64_t next = 0;
+        for (const auto& seg : space.segments()) {
+            REQUIRE(seg.lock()->start >= next);
+            found |= seg.lock()->start == next && next != 0;
+            next = uint64_t(seg.lock()->end()) + 1;
+        }
+        REQUIRE(found == adjacent);
+    };
+
+    // Inserts copies of 16-byte segments at @p addresses, which share their bytes with the segments kept in @p shared
+    std::vector<Seg> shared;
+    auto insertShared = [&](const std::vector<uint32_t>& addresses) {
+        for (uint32_t a : addresses) {
+            std::vector<uint8_t> bytes(0x10);
+            std::iota(bytes.begin(), bytes.end(), static_cast<uint8_t>(a));
+            shared.emplace_back();
+            shared.back().start = a;
+            shared.back().data = std::move(bytes);
+            sas.insertSegment(shared.back());
+        }
+    };
+
+    SECTION("Compaction") {
+        sas.setCoalescing(deferral, 0);
+        for (uint32_t a = 0; a < 0x100; a += 0x10) {
+            insertShared({0x1000 + a, 0x2FF0 - a});
+        }
+        REQUIRE(sas.segments().size() == 32);
+        REQUIRE(sas.fragmentation() > 0.5);
+        requireAdjacent(sas, true);
+
+        // An insert overlapping larger shared segments trims them
+        sas.insertSegment(0x108C, std::vector<uint8_t>(0x8, 0xEE));
+        REQUIRE(sas.segments().size() == 33);
+        requireAdjacent(sas, true);
+
+        sas.compact();
+        REQUIRE(sas.segments().size() == 2);
+        REQUIRE(sas.fragmentation() == 0);
+        requireAdjacent(sas, false);
+        for (uint32_t a = 0x1000; a < 0x1100; a++) {
+            REQUIRE(sas.readByte(a) == (a >= 0x108C && a < 0x1094 ? 0xEE : static_cast<uint8_t>(a)));
+            REQUIRE(sas.readByte(a + 0x1F00) == static_cast<uint8_t>(a));
+        }
+        REQUIRE(shared.front().data[0] == 0);
+    }
+
+    SECTION("Automatic compaction") {
+        sas.setCoalescing(deferral, 0.5);
+        for (uint32_t a = 0x1000; a < 0x2000; a += 0x10) {
+            insertShared({a});
+            REQUIRE(sas.fragmentation() <= 0.5);
+        }
+        REQUIRE(sas.segments().size() <= 3);
+
+        // Switching to eager coalescing compacts the address space
+        sas.setCoalescing(SASCoalescing::Eager);
+        REQUIRE(sas.segments().size() == 1);
+    }
+
+    SECTION("Private segments") {
+        // Coalescing segments with private bytes only copies the smaller segment, and is only deferred if all
+        // coalescing is
+        sas.setCoalescing(deferral, 0);
+        for (uint32_t a = 0x1000; a < 0x1100; a++) {
+            sas.writeByte(a, static_cast<uint8_t>(a));
+            sas.writeByte(0x3000 - a, static_cast<uint8_t>(a));
+        }
+        if (deferral == SASCoalescing::Deferred) {
+            REQUIRE(sas.segments().size() > 2);
+            REQUIRE(sas.fragmentation() > 0.5);
+            requireAdjacent(sas, true);
+            sas.compact();
+        }
+        REQUIRE(sas.segments().size() == 2);
+        REQUIRE(sas.fragmentation() == 0);
+        REQUIRE(sas.readByte(0x10FF) == 0xFF);
+        REQUIRE(sas.readByte(0x1F01) == 0xFF);
+    }
+
+    SECTION("Initialization segments") {
+        sas.setCoalescing(deferral, 0);
+        sas.getInitSas().insertSegment(0x1000, std::vector<uint8_t>(0x1000, 1));
+        sas.reset();
+        for (uint32_t a = 0xFFF; a > 0xF00; a--) {
+            sas.writeByte(a, 2);
+        }
+        for (uint32_t a = 0x2000; a < 0x2100; a++) {
+            sas.writeByte(a, 3);
+        }
+
+        // The segment shared with the initialization SAS is not copied, and unless all coalescing is deferred, the
+        // segments next to it are coalesced
+        if (deferral == SASCoalescing::Deferred) {
+            REQUIRE(sas.segments().size() > 3);
+        } else {
+            REQUIRE(sas.segments().size() == 3);
+        }
+        REQUIRE(sas.contains(0x1000)->data.data() == sas.getInitSas().contains(0x1000)->data.data());
+        requireAdjacent(sas, true);
+        sas.compact();
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(sas.readByte(0xF01) == 2);
+        REQUIRE(sas.readByte(0x1FFF) == 1);
+        REQUIRE(sas.readByte(0x20FF) == 3);
+    }
+
+    SECTION("Equivalent to eager coalescing") {
+        SAS eager(s_minsegsize);
+        sas.setCoalescing(deferral, 0);
+        sas.setMaxSegmentSize(0x200);
+        eager.setMaxSegmentSize(0x200);
+        std::vector<SAS::Segment> bulk;
+        for (int i = 0; i < 2000; i++) {
+            const uint32_t address = std::rand() % 0x4000;
+            const uint8_t value = static_cast<uint8_t>(i);
+            switch (std::rand() % 3) {
+                case 0:
+                    sas.writeByte(address, value);
+                    eager.writeByte(address, value);
+                    break;
+                case 1: {
+                    std::vector<uint8_t> bytes(1 + std::rand() % 0x100, value);
+                    sas.insertSegment(address, bytes);
+                    eager.insertSegment(address, std::move(bytes));
+                    break;
+                }
+                default: {
+                    SAS::Segment seg;
+                    seg.start = address;
+                    seg.data = std::vector<uint8_t>(1 + std::rand() % 0x100, value);
+                    bulk.push_back(seg);
+                    if (bulk.size() == 16) {
+                        sas.insertSegments(bulk.begin(), bulk.end());
+                        eager.insertSegments(bulk.begin(), bulk.end());
+                        bulk.clear();
+                    }
+                }
+            }
+        }
+        std::vector<uint8_t> expected(0x4200), actual(0x4200);
+        eager.readBytes(0, expected.data(), expected.size());
+        sas.readBytes(0, actual.data(), actual.size());
+        REQUIRE(actual == expected);
+
+        sas.compact();
+        sas.readBytes(0, actual.data(), actual.size());
+        REQUIRE(actual == expected);
+        for (const auto& seg : sas.segments()) {
+            REQUIRE(seg.lock()->data.size() <= 0x200);
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("Growth policies", "", CenteredGrowth, StrideGrowth, GeometricGrowth<>, PageAlignedGrowth<>) {
+    using GSAS = SparseAddressSpace<uint32_t, IntervalStorage<uint32_t, TestType>>;
+    GSAS sas(s_minsegsize);
+
+    // Sequential, descending, strided and random writes, verified against a reference array
+    std::vector<uint8_t> reference(0x20000, 0);
+    auto write = [&](uint32_t address, uint8_t value) {
+        sas.writeByte(address, value);
+        reference[address] = value;
+    };
+    for (uint32_t a = 0x1000; a < 0x3000; a++) {
+        write(a, static_cast<uint8_t>(a));
+    }
+    for (uint32_t a = 0x8000; a > 0x6000; a--) {
+        write(a, static_cast<uint8_t>(a * 3));
+    }
+    for (uint32_t a = 0x9000; a < 0xC000; a += 37) {
+        write(a, static_cast<uint8_t>(a * 5));
+    }
+    for (unsigned i = 0; i < 2000; i++) {
+        write(static_cast<uint32_t>(std::rand() % reference.size()), static_cast<uint8_t>(i));
+    }
+
+    std::vector<uint8_t> bytes(reference.size());
+    sas.readBytes(0, bytes.data(), bytes.size());
+    REQUIRE(bytes == reference);
+    // Segments never overlap
+    uint64_t next = 0;
+    for (const auto& seg : sas.segments()) {
+        REQUIRE(seg.lock()->start >= next);
+        next = uint64_t(seg.lock()->end()) + 1;
+    }
+}
+
+TEST_CASE("Growth policy bounds") {
+    auto bounds = [](const auto& sas, uint32_t address) {
+        const auto* seg = sas.contains(address);
+        REQUIRE(seg != nullptr);
+        return std::make_pair(seg->start, seg->end());
+    };
+
+    SECTION("Stride") {
+        SparseAddressSpace<uint32_t, IntervalStorage<uint32_t, StrideGrowth>> sas(5);
+        sas.writeByte(0x1000, 1);
+        sas.writeByte(0x2000, 1);
+        REQUIRE(bounds(sas, 0x2000) == std::make_pair(0x2000u, 0x2004u));
+        sas.writeByte(0x1800, 1);
+        REQUIRE(bounds(sas, 0x1800) == std::make_pair(0x17FCu, 0x1800u));
+    }
+
+    SECTION("Geometric") {
+        SparseAddressSpace<uint32_t, IntervalStorage<uint32_t, GeometricGrowth<0x1000>>> sas(5);
+        for (uint32_t a = 0x10000; a < 0x10100; a++) {
+            sas.writeByte(a, 1);
+        }
+        // Each extension doubles the segment, so the segment is at most twice the written size
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(bounds(sas, 0x10000).second < 0x10200);
+        for (uint32_t a = 0x10100; a < 0x20000; a++) {
+            sas.writeByte(a, 1);
+        }
+        // Extensions are limited to MaxGrowth bytes
+        REQUIRE(bounds(sas, 0x10000).second < 0x20000 + 0x1000);
+        const uint32_t below = bounds(sas, 0x10000).first - 1;
+        sas.writeByte(below, 1);
+        REQUIRE(bounds(sas, below).first == below - 0x1000 + 1);
+    }
+
+    SECTION("Page aligned") {
+        SparseAddressSpace<uint32_t, IntervalStorage<uint32_t, PageAlignedGrowth<12>>> sas(5);
+        sas.writeByte(0x1234, 1);
+        REQUIRE(bounds(sas, 0x1234) == std::make_pair(0x1000u, 0x1FFFu));
+        sas.insertSegment(0x3000, std::vector<uint8_t>(0x10, 2));
+        sas.insertSegment(0x3F00, std::vector<uint8_t>(0x10, 2));
+        sas.writeByte(0x3800, 1);
+        REQUIRE(bounds(sas, 0x3800) == std::make_pair(0x3000u, 0x3F0Fu));
+    }
+}
+
+TEMPLATE_TEST_CASE("Snapshot and fork", "", SAS, (SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>)) {
+    TestType sas(s_minsegsize);
+    sas.insertSegment(0x1000, std::vector<uint8_t>(0x100, 1));
+    sas.insertSegment(0x8000, std::vector<uint8_t>(0x100, 2));
+
+    SECTION("Restore") {
+        auto snap = sas.snapshot();
+        REQUIRE(sas.contains(0x1000)->data.data() == snap->find(0x1000)->data.data());
+
+        sas.writeByte(0x1010, 3);
+        sas.writeByte(0x20000, 4);
+        REQUIRE(snap->find(0x1010)->data[0x1010 - snap->find(0x1010)->start] == 1);
+
+        sas.restore(snap);
+        REQUIRE(sas.readByte(0x1010) == 1);
+        REQUIRE(sas.contains(0x20000) == nullptr);
+        REQUIRE(sas.contains(0x8000)->data.data() == snap->find(0x8000)->data.data());
+
+        // A snapshot may be restored multiple times, and into other address spaces
+        sas.writeByte(0x1010, 5);
+        TestType other(s_minsegsize);
+        other.restore(snap);
+        REQUIRE(other.readByte(0x1010) == 1);
+        sas.restore(snap);
+        REQUIRE(sas.readByte(0x1010) == 1);
+    }
+
+    SECTION("Fork") {
+        sas.getInitSas().insertSegment(0x1000, std::vector<uint8_t>(0x10, 7));
+        sas.writeByte(0x1000, 8);
+
+        TestType f = sas.fork();
+        REQUIRE(f.readByte(0x1000) == 8);
+        REQUIRE(f.contains(0x8000)->data.data() == sas.contains(0x8000)->data.data());
+
+        // The fork and the original evolve independently
+        f.writeByte(0x8000, 9);
+        sas.writeByte(0x8001, 10);
+        REQUIRE(sas.readByte(0x8000) == 2);
+        REQUIRE(f.readByte(0x8001) == 2);
+
+        // The fork has its own initialization SAS
+        f.getInitSas().writeByte(0x1001, 11);
+        f.reset();
+        sas.reset();
+        REQUIRE(f.readByte(0x1000) == 7);
+        REQUIRE(f.readByte(0x1001) == 11);
+        REQUIRE(sas.readByte(0x1001) == 7);
+        REQUIRE(f.contains(0x8000) == nullptr);
+    }
+
+    SECTION("Forks on other threads") {
+        // Each fork is written on its own thread while the others, and the original, drop their shared bytes
+        constexpr unsigned nThreads = 4;
+        std::vector<TestType> forks;
+        for (unsigned t = 0; t < nThreads; t++) {
+            forks.push_back(sas.fork());
+        }
+        std::vector<std::thread> threads;
+        std::vector<int> errors(nThreads, 0);
+        for (unsigned t = 0; t < nThreads; t++) {
+            threads.emplace_back([&, t] {
+                for (uint32_t a = 0x1000; a < 0x1100; a++) {
+                    forks[t].writeByte(a, static_cast<uint8_t>(forks[t].readByte(a) + t));
+                }
+                for (uint32_t a = 0x1000; a < 0x1100; a++) {
+                    errors[t] += forks[t].readByte(a) != 1 + t;
+                }
+                forks[t].clear();
+            });
+        }
+        sas.clear();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(std::accumulate(errors.begin(), errors.end(), 0) == 0);
+    }
+}
+
+TEST_CASE("LZ4 codec") {
+    auto roundTrip = [](const std::vector<uint8_t>& bytes) {
+        std::vector<uint8_t> compressed(Lz4Codec::compressBound(bytes.size()));
+        compressed.resize(Lz4Codec::compress(bytes.data(), bytes.size(), compressed.data()));
+        std::vector<uint8_t> decompressed(bytes.size());
+        Lz4Codec::decompress(compressed.data(), compressed.size(), decompressed.data(), decompressed.size());
+        REQUIRE(decompressed == bytes);
+        return compressed;
+    };
+
+    for (const size_t n : {0, 1, 12, 13, 100, 0x10000, 0x12345}) {
+        std::vector<uint8_t> random(n), pattern(n);
+        for (size_t i = 0; i < n; i++) {
+            random[i] = static_cast<uint8_t>(std::rand());
+            pattern[i] = static_cast<uint8_t>(i % 7 == 0 ? i : i % 3);
+        }
+        roundTrip(random);
+        roundTrip(pattern);
+        const auto zeros = roundTrip(std::vector<uint8_t>(n, 0));
+        if (n >= 0x10000) {
+            REQUIRE(zeros.size() < n / 50);
+        }
+    }
+
+    // Malformed blocks
+    std::vector<uint8_t> bytes(1000);
+    std::iota(bytes.begin(), bytes.end(), 0);
+    bytes.insert(bytes.end(), bytes.begin(), bytes.end());
+    std::vector<uint8_t> compressed(Lz4Codec::compressBound(bytes.size()));
+    compressed.resize(Lz4Codec::compress(bytes.data(), bytes.size(), compressed.data()));
+    std::vector<uint8_t> out(bytes.size());
+    REQUIRE_THROWS(Lz4Codec::decompress(compressed.data(), compressed.size() - 1, out.data(), out.size()));
+    REQUIRE_THROWS(Lz4Codec::decompress(compressed.data(), compressed.size(), out.data(), out.size() - 1));
+    REQUIRE_THROWS(Lz4Codec::decompress(compressed.data(), 0, out.data(), out.size()));
+    out.resize(out.size() + 1);
+    REQUIRE_THROWS(Lz4Codec::decompress(compressed.data(), compressed.size(), out.data(), out.size()));
+
+    SECTION("Deferred segment data") {
+        int fills = 0;
+        SASSegmentData data = SASSegmentData::deferred(16, [&](uint8_t* dst) {
+            fills++;
+            std::memset(dst, 3, 16);
+        });
+        const SASSegmentData copy = data;
+        REQUIRE(data.isDeferred());
+        REQUIRE(fills == 0);
+        REQUIRE(copy[15] == 3);
+        REQUIRE(data[0] == 3);
+        REQUIRE(fills == 1);
+        REQUIRE(data.data() == copy.data());
+
+        // Writes are copy-on-write as for any other segment data
+        data.mutableData()[0] = 4;
+        REQUIRE(copy[0] == 3);
+        REQUIRE(!data.isShared());
+    }
+}
+
+TEMPLATE_TEST_CASE("Snapshot files", "", SAS, (SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>)) {
+    const std::string path = "sas_test_snapshot.bin";
+    TestType sas(s_minsegsize);
+    for (unsigned i = 0; i < 200; i++) {
+        sas.writeValue(static_cast<uint32_t>(std::rand() % (1 << 20)), static_cast<uint32_t>(std::rand()));
+    }
+    sas.insertSegment(0xFFFFFF00, std::vector<uint8_t>(0x100, 0xEE));
+    sas.save(path);
+
+    auto contents = [](const TestType& s) {
+        std::vector<std::pair<uint32_t, std::vector<uint8_t>>> result;
+        for (const auto& seg : s.segments()) {
+            const auto locked = seg.lock();
+            result.push_back({locked->start, std::vector<uint8_t>(locked->data.data(),
+                                                                  locked->data.data() + locked->data.size())});
+        }
+        return result;
+    };
+
+    SECTION("Load") {
+        TestType loaded(s_minsegsize);
+        loaded.writeByte(0x7FFFFFFF, 1);
+        loaded.load(path);
+        REQUIRE(contents(loaded) == contents(sas));
+        REQUIRE(loaded.contains(0x7FFFFFFF) == nullptr);
+
+        // Segments use the mapped payloads directly, and writing to them does not modify the file
+        if (SASSegmentData::mapFile(path).isMapped()) {
+            REQUIRE(loaded.contains(0xFFFFFF00)->data.isMapped());
+        }
+        loaded.writeByte(0xFFFFFF00, 1);
+        loaded.writeByte(0x90000000, 2);
+        TestType reloaded(s_minsegsize);
+        reloaded.load(path);
+        REQUIRE(contents(reloaded) == contents(sas));
+
+        // Saving over the file does not invalidate segments loaded from it
+        loaded.save(path);
+        REQUIRE(reloaded.readByte(0xFFFFFF00) == 0xEE);
+        reloaded.load(path);
+        REQUIRE(contents(reloaded) == contents(loaded));
+    }
+
+    SECTION("Compressed") {
+        sas.insertSegment(0x40000000, std::vector<uint8_t>(0x30000, 0));
+        sas.save(path);
+        const size_t rawSize = std::ifstream(path, std::ios::binary | std::ios::ate).tellg();
+        sas.save(path, true);
+        REQUIRE(static_cast<size_t>(std::ifstream(path, std::ios::binary | std::ios::ate).tellg()) < rawSize / 2);
+
+        // Segments are decompressed upon their first access, and shared with address spaces reset from them
+        TestType loaded(s_minsegsize);
+        loaded.getInitSas().load(path);
+        loaded.reset();
+        REQUIRE(loaded.getInitSas().contains(0xFFFFFF00)->data.isDeferred());
+        REQUIRE(loaded.readByte(0xFFFFFF00) == 0xEE);
+        REQUIRE(!loaded.contains(0xFFFFFF00)->data.isDeferred());
+        REQUIRE(loaded.getInitSas().contains(0x40000000)->data.isDeferred());
+        REQUIRE(contents(loaded) == contents(sas));
+        REQUIRE(loaded.getInitSas().contains(0xFFFFFF00)->data.data() == loaded.contains(0xFFFFFF00)->data.data());
+
+        loaded.writeByte(0x40000010, 1);
+        REQUIRE(loaded.getInitSas().readByte(0x40000010) == 0);
+        loaded.reset();
+        REQUIRE(contents(loaded) == contents(sas));
+
+        // Saving deferred segments fills them before compressing them from multiple threads
+        TestType resaved(s_minsegsize);
+        resaved.load(path);
+        REQUIRE(resaved.contains(0x40000000)->data.isDeferred());
+        resaved.save(path, true);
+        REQUIRE(!resaved.contains(0x40000000)->data.isDeferred());
+        resaved.load(path);
+        REQUIRE(contents(resaved) == contents(sas));
+
+        // Chunk sizes are validated upon loading
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint8_t entry[32];
+        file.seekg(32);
+        file.read(reinterpret_cast<char*>(entry), sizeof(entry));
+        file.seekp(SASFileFormat::get(entry + 16, 8));
+        file.put(0x7F);
+        file.close();
+        REQUIRE_THROWS(loaded.getInitSas().load(path));
+        REQUIRE(loaded.getInitSas().readByte(0xFFFFFF00) == 0xEE);
+    }
+
+    SECTION("Adjacent segments") {
+        // Adjacent saved segments keep their bounds, even without a limit, such that loading does not copy or
+        // decompress them
+        TestType bounded(s_minsegsize);
+        bounded.setMaxSegmentSize(0x100);
+        bounded.insertSegment(0x1000, std::vector<uint8_t>(0x300, 1));
+        for (const bool compressed : {false, true}) {
+            bounded.save(path, compressed);
+            TestType loaded(s_minsegsize);
+            loaded.load(path);
+            if (std::is_same<TestType, SAS>::value) {
+                REQUIRE(loaded.segments().size() == 3);
+                for (const auto& seg : loaded.segments()) {
+                    REQUIRE(seg.lock()->data.isDeferred() == compressed);
+                }
+            }
+            REQUIRE(contents(loaded) == contents(bounded));
+        }
+    }
+
+    SECTION("Invalid files") {
+        auto bytes = [&] {
+            std::ifstream in(path, std::ios::binary);
+            return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        };
+        auto write = [&](const std::vector<uint8_t>& file) {
+            std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+        };
+        const std::vector<uint8_t> valid = bytes();
+        TestType loaded(s_minsegsize);
+        loaded.writeByte(0x10, 1);
+
+        std::vector<uint8_t> file = valid;
+        file[0] = 'X';
+        write(file);
+        REQUIRE_THROWS(loaded.load(path));
+
+        // Truncated payloads
+        write(std::vector<uint8_t>(valid.begin(), valid.end() - 1));
+        REQUIRE_THROWS(loaded.load(path));
+
+        // Unsorted segment table
+        file = valid;
+        std::swap_ranges(file.begin() + 24, file.begin() + 48, file.begin() + 48);
+        write(file);
+        REQUIRE_THROWS(loaded.load(path));
+
+        // Snapshots of address spaces of other address sizes
+        SparseAddressSpace<uint64_t> wide;
+        wide.writeByte(0x100000000, 1);
+        wide.save(path);
+        REQUIRE_THROWS(loaded.load(path));
+        REQUIRE_THROWS(loaded.load("does_not_exist.bin"));
+
+        // Failed loads leave the address space untouched
+        REQUIRE(loaded.readByte(0x10) == 1);
+        REQUIRE(loaded.segments().size() == 1);
+    }
+    std::remove(path.c_str());
+}
+
+TEMPLATE_TEST_CASE("Background reads", "", SAS, (SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>)) {
+    TestType sas(s_minsegsize);
+    sas.insertSegment(0x30000, std::vector<uint8_t>{1, 2});
+
+    SECTION("Per call") {
+        REQUIRE(sas.readByte(0x10000, SASReadMode::Background) == 0);
+        REQUIRE(sas.template readValue<uint32_t>(0x2FFFE, SASReadMode::Background) == 0x02010000);
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(sas.readByte(0x10000) == 0);
+        REQUIRE(sas.segments().size() == 2);
+    }
+
+    SECTION("Per instance") {
+        sas.setReadMode(SASReadMode::Background);
+        sas.setBackgroundValue(0xAA);
+        for (uint32_t address = 0; address < 0x100000; address += 0x100) {
+            if (!sas.contains(address)) {
+                REQUIRE(sas.readByte(address) == 0xAA);
+            }
+        }
+        REQUIRE(sas.template readValue<uint32_t>(0x2FFFE) == 0x0201AAAA);
+        REQUIRE(sas.template readValue<uint64_t>(0xFFFFFFFC) == 0xAAAAAAAAAAAAAAAAull);
+        uint8_t bytes[4];
+        sas.readBytes(0x2FFFE, bytes, sizeof(bytes));
+        REQUIRE(bytes[0] == 0xAA);
+        REQUIRE(bytes[3] == 2);
+        REQUIRE(sas.segments().size() == 1);
+        REQUIRE(sas.readByte(0x40000, SASReadMode::Materialize) == 0xAA);
+        REQUIRE(sas.segments().size() == 2);
+
+        // Segments are created by writes, holding the background value in their unwritten bytes
+        sas.writeByte(0x50000, 1);
+        REQUIRE(sas.readByte(0x50001) == 0xAA);
+        REQUIRE(sas.contains(0x50001)->data[0x50001 - sas.contains(0x50001)->start] == 0xAA);
+
+        // Forks and the initialization SAS share the configuration
+        TestType f = sas.fork();
+        REQUIRE(f.readMode() == SASReadMode::Background);
+        REQUIRE(f.readByte(0x60000) == 0xAA);
+        REQUIRE(f.segments().size() == sas.segments().size());
+        REQUIRE(sas.getInitSas().readByte(0x60000) == 0xAA);
+    }
+}
+
+TEMPLATE_TEST_CASE("Incremental reset", "", SAS, (SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>>)) {
+    TestType sas(s_minsegsize);
+    sas.getInitSas().insertSegment(0x1000, std::vector<uint8_t>(0x3000, 1));
+    sas.getInitSas().insertSegment(0x10000, std::vector<uint8_t>(0x100, 2));
+    sas.setDirtyTracking(true, 8);
+    sas.reset();
+    const size_t nInitSegments = sas.segments().size();
+
+    // Write within the first segment, which makes its bytes private
+    sas.writeByte(0x1010, 3);
+    sas.writeValue(0x2000, uint32_t(0x04040404));
+    const uint8_t* privateBytes = sas.contains(0x1000)->data.data();
+    REQUIRE(privateBytes != sas.getInitSas().contains(0x1000)->data.data());
+
+    // Write outside of the initialization segments, and adjacent to the second segment
+    sas.writeByte(0x80000000u, 5);
+    sas.writeByte(0x10100, 6);
+
+    // getInitSas() forces a full reset; perform one incremental reset cycle using the recorded state
+    sas.reset();
+    auto verifyInit = [&] {
+        REQUIRE(sas.segments().size() == nInitSegments);
+        std::vector<uint8_t> buf(0x3000);
+        sas.readBytes(0x1000, buf.data(), buf.size());
+        REQUIRE(buf == std::vector<uint8_t>(0x3000, 1));
+        REQUIRE(sas.readByte(0x10000) == 2);
+        REQUIRE(sas.readByte(0x100FF) == 2);
+        REQUIRE(!sas.contains(0x80000000u));
+    };
+    sas.writeByte(0x1010, 3);
+    sas.writeBytes(0x2FFE, std::vector<uint8_t>(4, 4).data(), 4);
+    sas.writeByte(0x80000000u, 5);
+    sas.writeByte(0x10100, 6);
+    sas.reset();
+    verifyInit();
+
+    // The written segment has been restored in place, rather than being shared anew
+    REQUIRE(sas.contains(0x1000)->data.data() != sas.getInitSas().contains(0x1000)->data.data());
+}
+
+TEST_CASE("Incremental reset of adjacent initialization segments") {
+    // Segments of the initialization SAS may be adjacent if it limits the segment size or defers coalescing. Resets
+    // must restore them with their own bounds, rather than coalescing them.
+    SAS sas(s_minsegsize);
+    auto verifyInit = [&] {
+        const auto segs = sas.segments();
+        const auto initSegs = sas.getInitSas().segments();
+        REQUIRE(segs.size() == initSegs.size());
+        for (size_t i = 0; i < segs.size(); i++) {
+            REQUIRE(*segs[i].lock() == *initSegs[i].lock());
+        }
+    };
+
+    SECTION("Maximum segment size") {
+        sas.setDirtyTracking(true, 2);
+        sas.setMaxSegmentSize(8);
+        sas.getInitSas().insertSegment(0, std::vector<uint8_t>(8, 1));
+        sas.getInitSas().insertSegment(2, std::vector<uint8_t>(8, 2));
+        sas.getInitSas().insertSegment(3, std::vector<uint8_t>(8, 3));
+        sas.reset();
+        sas.writeBytes(1, std::vector<uint8_t>(2, 4).data(), 2);
+        sas.reset();
+        sas.writeByte(2, 5);
+        sas.reset();
+        verifyInit();
+
+        // Raising the limit coalesces the initialization SAS again
+        SAS raised(s_minsegsize);
+        raised.setDirtyTracking(true, 2);
+        raised.setMaxSegmentSize(8);
+        raised.getInitSas().insertSegment(0, std::vector<uint8_t>(16, 1));
+        raised.setMaxSegmentSize(16);
+        raised.reset();
+        raised.writeByte(3, 2);
+        raised.reset();
+        raised.writeByte(12, 3);
+        raised.reset();
+        REQUIRE(raised.readByte(3) == 1);
+        REQUIRE(raised.readByte(12) == 1);
+        REQUIRE(raised.segments().size() == raised.getInitSas().segments().size());
+        REQUIRE(raised.segments().size() == 1);
+    }
+
+    SECTION("Changing the maximum segment size") {
+        // Lowering the limit splits the initialization segments, which the segments of the last reset no longer match
+        sas.setMaxSegmentSize(64);
+        sas.getInitSas().insertSegment(100, std::vector<uint8_t>(74, 1));
+        sas.setDirtyTracking(true);
+        sas.reset();
+        sas.insertSegment(42, std::vector<uint8_t>(64, 2));
+        sas.setMaxSegmentSize(30);
+        sas.reset();
+        verifyInit();
+        sas.writeByte(165, 3);
+        sas.reset();
+        verifyInit();
+    }
+
+    SECTION("Deferred coalescing") {
+        sas.setDirtyTracking(true, 2);
+        sas.getInitSas().setCoalescing(SASCoalescing::DeferShared, 0);
+        // The initialization segments share their bytes with these, such that coalescing them is deferred
+        Seg low, high;
+        low.start = 0;
+        low.data = std::vector<uint8_t>(8, 1);
+        high.start = 8;
+        high.data = std::vector<uint8_t>(8, 2);
+        sas.getInitSas().insertSegment(low);
+        sas.getInitSas().insertSegment(high);
+        REQUIRE(sas.getInitSas().segments().size() == 2);
+        sas.reset();
+        sas.writeBytes(6, std::vector<uint8_t>(4, 3).data(), 4);
+        sas.reset();
+        sas.writeByte(12, 5);
+        sas.reset();
+        verifyInit();
+    }
+}
+
+TEMPLATE_TEST_CASE("Undo journal", "", (SparseAddressSpace<uint32_t, IntervalStorage<uint32_t>, UndoJournal<uint32_t>>),
+                   (SparseAddressSpace<uint32_t, PageTableStorage<uint32_t>, UndoJournal<uint32_t>>)) {
+    TestType sas(s_minsegsize);
+    sas.insertSegment(0x1000, std::vector<uint8_t>(0x100, 1));
+    sas.journal().clear();
+
+    SECTION("Rewind") {
+        sas.journal().setStep(1);
+        sas.writeByte(0x1000, 2);
+        sas.journal().setStep(2);
+        sas.writeValue(0x10FE, uint32_t(0x03030303));
+        sas.writeBytes(0x1010, std::vector<uint8_t>(0x10, 4).data(), 0x10);
+        sas.journal().setStep(3);
+        sas.writeBytes(0x1080, std::vector<uint8_t>(0x200, 5).data(), 0x200);
+        sas.insertSegment(0x5000, std::vector<uint8_t>(0x10, 6));
+        REQUIRE(sas.journal().entries() > 0);
+
+        sas.rewindTo(2);
+        REQUIRE(sas.readByte(0x1080) == 1);
+        REQUIRE(sas.readByte(0x1200) == 0);
+        REQUIRE(sas.readByte(0x5000) == 0);
+        REQUIRE(sas.template readValue<uint32_t>(0x10FE) == 0x03030303);
+        REQUIRE(sas.readByte(0x1010) == 4);
+
+        sas.rewindTo(0);
+        REQUIRE(sas.readByte(0x1000) == 1);
+        REQUIRE(sas.readByte(0x1010) == 1);
+        REQUIRE(sas.template readValue<uint32_t>(0x10FE) == 0x00000101);
+        REQUIRE(sas.journal().entries() == 0);
+    }
+
+    SECTION("Eviction") {
+        sas.journal().setCapacity(256);
+        for (uint64_t step = 1; step <= 100; step++) {
+            sas.journal().setStep(step);
+            sas.writeByte(0x1000 + step, static_cast<uint8_t>(step));
+        }
+        REQUIRE(sas.journal().horizon() > 1);
+        REQUIRE_THROWS(sas.rewindTo(sas.journal().horizon() - 1));
+
+        const uint64_t horizon = sas.journal().horizon();
+        sas.rewindTo(horizon);
+        for (uint64_t step = 1; step <= 100; step++) {
+            REQUIRE(sas.readByte(0x1000 + step) == (step <= horizon ? step : 1));
+        }
+    }
+
+    SECTION("Random rewinds") {
+        // Snapshot the address space after each step, and compare against the snapshots after rewinding
+        std::vector<std::vector<uint8_t>> states;
+        auto state = [&] {
+            std::vector<uint8_t> bytes(0x400);
+            sas.readBytes(0x1000, bytes.data(), bytes.size());
+            return bytes;
+        };
+        states.push_back(state());
+        for (uint64_t step = 1; step <= 200; step++) {
+            sas.journal().setStep(step);
+            for (int i = 0; i < 4; i++) {
+                const uint32_t addr = 0x1000 + std::rand() % 0x3F8;
+                if (std::rand() % 2) {
+                    sas.writeValue(addr, static_cast<uint64_t>(std::rand()), 1 + std::rand() % 8);
+                } else {
+                    sas.writeByte(addr, static_cast<uint8_t>(std::rand()));
+                }
+            }
+            states.push_back(state());
+        }
+        for (int64_t step = 200; step >= 0; step -= 1 + std::rand() % 20) {
+            sas.rewindTo(step);
+            REQUIRE(state() == states[step]);
+        }
+    }
+
+    SECTION("Reset drops the journal") {
+        sas.getInitSas().insertSegment(0x1000, std::vector<uint8_t>(0x10, 7));
+        sas.reset();
+        sas.journal().setStep(1);
+        sas.writeByte(0x1000, 8);
+        sas.reset();
+        REQUIRE(sas.journal().entries() == 0);
+        REQUIRE(sas.getInitSas().journal().entries() == 0);
+    }
+}
+
+TEST_CASE("Concurrent address space") {
+    using CSAS = ConcurrentSparseAddressSpace<uint64_t>;
+    CSAS sas;
+
+    SECTION("Single-threaded access") {
+        REQUIRE(sas.readByte(0x1000) == 0);
+        REQUIRE(sas.pageCount() == 0);
+
+        sas.writeValue(0x1FFE, uint32_t(0x01020304));
+        REQUIRE(sas.pageCount() == 2);
+        REQUIRE(sas.readValue<uint32_t>(0x1FFE) == 0x01020304);
+        REQUIRE(sas.readByte(0x2001) == 0x01);
+
+        sas.writeByte(CSAS::c_maxAddr, 5);
+        REQUIRE(sas.readByte(CSAS::c_maxAddr) == 5);
+
+        std::vector<uint8_t> buf(0x3000, 6);
+        sas.writeBytes(0x10800, buf.data(), buf.size());
+        std::vector<uint8_t> read(0x4000);
+        sas.readBytes(0x10000, read.data(), read.size());
+        REQUIRE(read[0x7FF] == 0);
+        REQUIRE(read[0x800] == 6);
+        REQUIRE(read[0x37FF] == 6);
+        REQUIRE(read[0x3800] == 0);
+
+        // Unaligned copies, which are split into bytes and aligned words
+        std::vector<uint8_t> ramp(37);
+        std::iota(ramp.begin(), ramp.end(), uint8_t(1));
+        sas.writeBytes(0x10803, ramp.data(), ramp.size());
+        std::vector<uint8_t> readRamp(ramp.size() + 2);
+        sas.readBytes(0x10802, readRamp.data(), readRamp.size());
+        REQUIRE(readRamp.front() == 6);
+        REQUIRE(std::equal(ramp.begin(), ramp.end(), readRamp.begin() + 1));
+        REQUIRE(readRamp.back() == 6);
+        REQUIRE(sas.readValue<uint32_t>(0x10805) == 0x06050403);
+
+        // Lookups cached before clearing must not be used afterwards
+        sas.clear();
+        REQUIRE(sas.pageCount() == 0);
+        REQUIRE(sas.readByte(0x10800) == 0);
+    }
+
+    SECTION("Stress") {
+        // Each thread writes its own region, which is interleaved page-wise with the regions of the other threads, such
+        // that threads race to install shared tables. Meanwhile, all threads read a shared read-only region.
+        constexpr unsigned nThreads = 8;
+        constexpr uint64_t nPages = 64;
+        constexpr uint64_t shared = 0x7FFF00000000;
+        for (uint64_t i = 0; i < nPages * CSAS::c_pageSize; i += 8) {
+            sas.writeValue(shared + i, i);
+        }
+
+        std::vector<std::thread> threads;
+        std::vector<int> errors(nThreads, 0);
+        for (unsigned t = 0; t < nThreads; t++) {
+            threads.emplace_back([&, t] {
+                for (uint64_t round = 0; round < 4; round++) {
+                    for (uint64_t p = 0; p < nPages; p++) {
+                        const uint64_t addr = ((p * nThreads + t) << 12) + round * 8;
+                        sas.writeValue(addr, addr);
+                        const uint64_t i = (p * 8 + t * 64 + round) % (nPages * CSAS::c_pageSize / 8) * 8;
+                        errors[t] += sas.readValue<uint64_t>(shared + i) != i;
+                    }
+                }
+                // Concurrent first-touch of the same, fresh pages
+                for (uint64_t p = 0; p < nPages; p++) {
+                    sas.writeByte(0x100000000 + (p << 12) + t, static_cast<uint8_t>(t + 1));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        REQUIRE(std::accumulate(errors.begin(), errors.end(), 0) == 0);
+        for (unsigned t = 0; t < nThreads; t++) {
+            for (uint64_t p = 0; p < nPages; p++) {
+                for (uint64_t round = 0; round < 4; round++) {
+                    const uint64_t addr = ((p * nThreads + t) << 12) + round * 8;
+                    REQUIRE(sas.readValue<uint64_t>(addr) == addr);
+                }
+                REQUIRE(sas.readByte(0x100000000 + (p << 12) + t) == t + 1);
+            }
+        }
+        REQUIRE(sas.pageCount() == 2 * nPages + nPages * nThreads);
+    }
+}
+
+TEST_CASE("Atomic memory operations") {
+    using CSAS = ConcurrentSparseAddressSpace<uint64_t>;
+    CSAS sas(8);
+
+    SECTION("Single hart") {
+        sas.writeValue(0x1000, uint32_t(5));
+        REQUIRE(sas.atomicFetchAdd<uint32_t>(0x1000, 3) == 5);
+        REQUIRE(sas.atomicSwap<uint32_t>(0x1000, 10) == 8);
+        REQUIRE(sas.readValue<uint32_t>(0x1000) == 10);
+
+        uint32_t expected = 9;
+        REQUIRE_FALSE(sas.compareExchange<uint32_t>(0x1000, expected, 11));
+        REQUIRE(expected == 10);
+        REQUIRE(sas.compareExchange<uint32_t>(0x1000, expected, 11));
+        REQUIRE(sas.readValue<uint32_t>(0x1000) == 11);
+
+        // Sizes and misalignment
+        REQUIRE(sas.atomicFetchAdd<uint8_t>(0x1003, 0xFF) == 0);
+        REQUIRE(sas.atomicFetchAdd<uint64_t>(0x2000, 1) == 0);
+        REQUIRE_THROWS(sas.atomicFetchAdd<uint16_t>(0x1001, 1));
+        REQUIRE_THROWS(sas.atomicSwap<uint64_t>(0x1004, 1));
+    }
+
+    SECTION("Reservations") {
+        REQUIRE(sas.loadReserved<uint64_t>(0x1000, 0) == 0);
+        REQUIRE(sas.storeConditional<uint64_t>(0x1000, 1, 0));
+        // The reservation is consumed by the store conditional
+        REQUIRE_FALSE(sas.storeConditional<uint64_t>(0x1000, 2, 0));
+
+        // A write of another hart to the same granule invalidates the reservation, even if the value is unchanged
+        sas.loadReserved<uint64_t>(0x1000, 0);
+        sas.writeValue(0x1038, uint64_t(0));
+        REQUIRE_FALSE(sas.storeConditional<uint64_t>(0x1000, 2, 0));
+
+        // Writes to other granules do not
+        sas.loadReserved<uint64_t>(0x1000, 0);
+        sas.writeValue(0x1040, uint64_t(0));
+        REQUIRE(sas.storeConditional<uint64_t>(0x1000, 2, 0));
+
+        // A successful store conditional of one hart invalidates the reservations of others
+        sas.loadReserved<uint64_t>(0x1000, 0);
+        sas.loadReserved<uint64_t>(0x1000, 1);
+        REQUIRE(sas.storeConditional<uint64_t>(0x1000, 3, 1));
+        REQUIRE_FALSE(sas.storeConditional<uint64_t>(0x1000, 4, 0));
+        REQUIRE(sas.readValue<uint64_t>(0x1000) == 3);
+
+        // Store conditional to a different granule than the reservation fails
+        sas.loadReserved<uint64_t>(0x1000, 0);
+        REQUIRE_FALSE(sas.storeConditional<uint64_t>(0x2000, 5, 0));
+        REQUIRE_THROWS(sas.loadReserved<uint64_t>(0x1000, 8));
+    }
+
+    SECTION("Concurrent increments") {
+        constexpr unsigned nThreads = 8;
+        constexpr unsigned nIncrements = 10000;
+        std::vector<std::thread> threads;
+        std::atomic<bool> done{false};
+        bool monotonic = true;
+        threads.emplace_back([&] {
+            // Plain reads of the counter see whole values only, which never decrease
+            uint32_t last = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                const uint32_t value = sas.readValue<uint32_t>(0x1000);
+                monotonic &= value >= last && value <= nThreads * nIncrements;
+                last = value;
+            }
+        });
+        for (unsigned t = 0; t < nThreads; t++) {
+            threads.emplace_back([&, t] {
+                for (unsigned i = 0; i < nIncrements; i++) {
+                    sas.atomicFetchAdd<uint32_t>(0x1000, 1);
+
+                    // LR/SC retry loop, interleaved with plain writes to the same granule
+                    uint64_t v;
+                    do {
+                        v = sas.loadReserved<uint64_t>(0x2000, t);
+                    } while (!sas.storeConditional<uint64_t>(0x2000, v + 1, t));
+                    sas.writeValue(0x2008 + t * 4, i);
+                }
+            });
+        }
+        for (size_t t = 1; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        done = true;
+        threads.front().join();
+        REQUIRE(monotonic);
+        REQUIRE(sas.readValue<uint32_t>(0x1000) == nThreads * nIncrements);
+        REQUIRE(sas.readValue<uint64_t>(0x2000) == nThreads * nIncrements);
+    }
+}
+
+TEST_CASE("Sharded address space") {
+    using SSAS = ShardedSparseAddressSpace<uint32_t, 4>;
+    SSAS sas;
+    REQUIRE(SSAS::shardIndex(0x3FFFFFFF) == 0);
+    REQUIRE(SSAS::shardIndex(0x40000000) == 1);
+    REQUIRE(SSAS::shardIndex(0xFFFFFFFF) == 3);
+
+    SECTION("Accesses across shard boundaries") {
+        sas.writeValue(0x3FFFFFFE, uint32_t(0x01020304));
+        REQUIRE(sas.readValue<uint32_t>(0x3FFFFFFE) == 0x01020304);
+        REQUIRE(sas.readByte(0x40000001) == 0x01);
+
+        std::vector<uint8_t> buf(0x100, 5);
+        sas.writeBytes(0x7FFFFF80, buf.data(), buf.size());
+        sas.withShard(1, [](SSAS::SAS& shard) { REQUIRE(shard.readByte(0x7FFFFFFF) == 5); });
+        sas.withShard(2, [](SSAS::SAS& shard) { REQUIRE(shard.readByte(0x80000000) == 5); });
+
+        std::vector<uint8_t> read(0x200);
+        sas.readBytes(0x7FFFFF00, read.data(), read.size());
+        REQUIRE(read[0x7F] == 0);
+        REQUIRE(read[0x80] == 5);
+        REQUIRE(read[0x17F] == 5);
+        REQUIRE(read[0x180] == 0);
+
+        sas.writeBytes(0xFFFFFF00, buf.data(), buf.size());
+        REQUIRE(sas.readByte(0xFFFFFFFF) == 5);
+        REQUIRE_THROWS(sas.writeBytes(0xFFFFFF01, buf.data(), buf.size()));
+    }
+
+    SECTION("Single shard") {
+        ShardedSparseAddressSpace<uint64_t, 1> single;
+        std::vector<uint8_t> buf(0x100, 6);
+        single.writeBytes(0xFFFFFFFFFFFFFF00, buf.data(), buf.size());
+        REQUIRE(single.readByte(0xFFFFFFFFFFFFFFFF) == 6);
+    }
+
+    SECTION("Parallel writers") {
+        // Each thread writes a private region in its own shard, as well as values straddling a shared boundary
+        constexpr unsigned nThreads = 4;
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < nThreads; t++) {
+            threads.emplace_back([&, t] {
+                const uint32_t base = t * 0x40000000u + 0x1000;
+                for (uint32_t i = 0; i < 0x1000; i += 4) {
+                    sas.writeValue(base + i, base + i);
+                }
+                sas.writeByte(0x3FFFFFFC + t, static_cast<uint8_t>(t + 1));
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (unsigned t = 0; t < nThreads; t++) {
+            const uint32_t base = t * 0x40000000u + 0x1000;
+            for (uint32_t i = 0; i < 0x1000; i += 4) {
+                REQUIRE(sas.readValue<uint32_t>(base + i) == base + i);
+            }
+        }
+        REQUIRE(sas.readValue<uint32_t>(0x3FFFFFFC) == 0x04030201);
+    }
+}
+
+/**
+ * @brief The TestElf struct
+ * Builds a minimal ELF executable with one program header per added segment.
+ */
+struct TestElf {
+    struct Load {
+        uint64_t vaddr, paddr;
+        std::vector<uint8_t> bytes;
+        uint64_t memsz;
+    };
+
+    bool is64;
+    bool bigEndian;
+    std::vector<Load> loads;
+
+    void put(std::vector<uint8_t>& f, size_t offset, uint64_t value, unsigned n) const {
+        for (unsigned i = 0; i < n; i++) {
+            f[offset + (bigEndian ? n - 1 - i : i)] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    }
+
+    std::vector<uint8_t> build(uint64_t entry) const {
+        const size_t ehsize = is64 ? 64 : 52;
+        const size_t phentsize = is64 ? 56 : 32;
+        std::vector<uint8_t> f(ehsize + phentsize * loads.size());
+        f[0] = 0x7F, f[1] = 'E', f[2] = 'L', f[3] = 'F';
+        f[4] = is64 ? 2 : 1;
+        f[5] = bigEndian ? 2 : 1;
+        f[6] = 1;
+        put(f, 16, 2, 2);  // ET_EXEC
+        put(f, 18, 0xF3, 2);
+        put(f, 24, entry, is64 ? 8 : 4);
+        put(f, is64 ? 32 : 28, ehsize, is64 ? 8 : 4);
+        put(f, is64 ? 54 : 42, phentsize, 2);
+        put(f, is64 ? 56 : 44, loads.size(), 2);
+        for (size_t i = 0; i < loads.size(); i++) {
+            const Load& l = loads[i];
+            const size_t ph = ehsize + i * phentsize;
+            const size_t offset = f.size();
+            f.insert(f.end(), l.bytes.begin(), l.bytes.end());
+            put(f, ph, 1, 4);  // PT_LOAD
+            if (is64) {
+                put(f, ph + 8, offset, 8);
+                put(f, ph + 16, l.vaddr, 8);
+                put(f, ph + 24, l.paddr, 8);
+                put(f, ph + 32, l.bytes.size(), 8);
+                put(f, ph + 40, l.memsz, 8);
+            } else {
+                put(f, ph + 4, offset, 4);
+                put(f, ph + 8, l.vaddr, 4);
+                put(f, ph + 12, l.paddr, 4);
+                put(f, ph + 16, l.bytes.size(), 4);
+                put(f, ph + 20, l.memsz, 4);
+            }
+        }
+        return f;
+    }
+};
+
+TEST_CASE("ELF loader") {
+    const bool is64 = GENERATE(false, true);
+    const bool bigEndian = GENERATE(false, true);
+    TestElf elf{is64, bigEndian, {}};
+    elf.loads.push_back({0x8000, 0x10000, std::vector<uint8_t>(0x100, 2), 0x180});
+    elf.loads.push_back({0x1000, 0x20000, std::vector<uint8_t>(0x80, 1), 0x80});
+    elf.loads.push_back({0x4000, 0x30000, {}, 0x10});
+    const std::vector<uint8_t> file = elf.build(0x1004);
+
+    SECTION("From memory") {
+        SAS sas;
+        const SASSegmentData image(file);
+        const auto info = ElfLoader::load(sas.getInitSas(), image);
+        REQUIRE(info.entry == 0x1004);
+        REQUIRE(info.elfClass == (is64 ? 64u : 32u));
+        REQUIRE(info.machine == 0xF3);
+        REQUIRE(info.segments == 3);
+
+        sas.reset();
+        REQUIRE(sas.segments().size() == 3);
+        REQUIRE(sas.readByte(0x1000) == 1);
+        REQUIRE(sas.readByte(0x107F) == 1);
+        REQUIRE(sas.readByte(0x80FF) == 2);
+        REQUIRE(sas.readByte(0x8100) == 0);
+        REQUIRE(sas.contains(0x817F) != nullptr);
+        REQUIRE(sas.contains(0x4000)->data.size() == 0x10);
+
+        // Segments without a zero-filled part are adopted from the image without copying
+        const uint8_t* bytes = sas.contains(0x1000)->data.data();
+        REQUIRE(bytes >= image.data());
+        REQUIRE(bytes < image.data() + file.size());
+
+        // Writing does not modify the image
+        sas.writeByte(0x1000, 3);
+        REQUIRE(sas.getInitSas().readByte(0x1000) == 1);
+    }
+
+    SECTION("From file") {
+        const std::string path = "sas_test_" + std::to_string(is64) + std::to_string(bigEndian) + ".elf";
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+
+        SAS sas;
+        ElfLoader::load(sas, path, true);
+        std::remove(path.c_str());
+        REQUIRE(sas.readByte(0x100FF) == 2);
+        REQUIRE(sas.readByte(0x1017F) == 0);
+        REQUIRE(sas.readByte(0x20000) == 1);
+        REQUIRE(sas.contains(0x3000F) != nullptr);
+        sas.writeByte(0x10000, 4);
+        REQUIRE(sas.readByte(0x10000) == 4);
+    }
+
+    SECTION("Copy-on-write per segment") {
+        TestElf multi{is64, bigEndian, {}};
+        multi.loads.push_back({0x1000, 0, std::vector<uint8_t>(0x1000, 1), 0x1000});
+        multi.loads.push_back({0x4000, 0, std::vector<uint8_t>(0x1000, 2), 0x1000});
+        multi.loads.push_back({0x8000, 0, std::vector<uint8_t>(0x1000, 3), 0x1000});
+        const std::vector<uint8_t> multiFile = multi.build(0);
+        const SASSegmentData image(multiFile);
+        auto inImage = [&](const uint8_t* bytes) {
+            return bytes >= image.data() && bytes < image.data() + multiFile.size();
+        };
+
+        SAS sas;
+        ElfLoader::load(sas, image);
+        sas.writeByte(0x4800, 4);
+
+        // Only the written segment is copied, in its entirety, while the others still use the image
+        const auto* written = sas.contains(0x4800);
+        REQUIRE(!inImage(written->data.data()));
+        REQUIRE(written->data.size() == 0x1000);
+        REQUIRE(!written->data.isShared());
+        REQUIRE(inImage(sas.contains(0x1000)->data.data()));
+        REQUIRE(inImage(sas.contains(0x8000)->data.data()));
+        REQUIRE(sas.readByte(0x4800) == 4);
+        REQUIRE(sas.readByte(0x47FF) == 2);
+        REQUIRE(std::count(image.begin(), image.end(), 4) == 0);
+    }
+
+    SECTION("Copy-on-write in place") {
+        TestElf multi{is64, bigEndian, {}};
+        multi.loads.push_back({0x1000, 0, std::vector<uint8_t>(0x1000, 1), 0x1000});
+        multi.loads.push_back({0x4000, 0, std::vector<uint8_t>(0x1000, 2), 0x1000});
+        std::vector<uint8_t> multiFile = multi.build(0);
+        SASSegmentData image(multiFile);
+        const uint8_t* base = image.data();
+        auto inImage = [&](const uint8_t* bytes) { return bytes >= base && bytes < base + multiFile.size(); };
+
+        // A moved-in image is split, so each segment is written in place without copying it
+        SAS sas;
+        ElfLoader::load(sas, std::move(image));
+        const uint8_t* bytes = sas.contains(0x4000)->data.data();
+        sas.writeByte(0x4800, 4);
+        REQUIRE(sas.contains(0x4800)->data.data() == bytes);
+        REQUIRE(inImage(bytes));
+        REQUIRE(sas.readByte(0x4800) == 4);
+        REQUIRE(sas.readByte(0x1800) == 1);
+
+        // Segments overlapping in the file are slices, such that writing one does not modify the other
+        const size_t ph = (is64 ? 64 : 52) + (is64 ? 56 : 32);
+        const uint64_t firstOffset = is64 ? 64 + 2 * 56 : 52 + 2 * 32;
+        multi.put(multiFile, ph + (is64 ? 8 : 4), firstOffset, is64 ? 8 : 4);
+        SAS overlapping;
+        ElfLoader::load(overlapping, SASSegmentData(multiFile));
+        overlapping.writeByte(0x4800, 4);
+        REQUIRE(overlapping.readByte(0x4800) == 4);
+        REQUIRE(overlapping.readByte(0x1800) == 1);
+        REQUIRE(overlapping.readByte(0x4801) == 1);
+    }
+
+    SECTION("Invalid files") {
+        SAS sas;
+        std::vector<uint8_t> bad = file;
+        bad[1] = 'X';
+        REQUIRE_THROWS(ElfLoader::load(sas, SASSegmentData(bad)));
+        REQUIRE_THROWS(ElfLoader::load(sas, "does_not_exist.elf"));
+
+        // Truncated segment contents
+        const SASSegmentData image(file);
+        REQUIRE_THROWS(ElfLoader::load(sas, image.slice(0, file.size() - 1)));
+
+        // Segments beyond a 16-bit address space
+        SparseAddressSpace<uint16_t> small;
+        REQUIRE_NOTHROW(ElfLoader::load(small, image));
+        TestElf high{is64, bigEndian, {{0xFFF0, 0, std::vector<uint8_t>(0x20, 1), 0x20}}};
+        REQUIRE_THROWS(ElfLoader::load(small, SASSegmentData(high.build(0))));
+    }
+}
+
+TEST_CASE("File-backed segments") {
+    const std::string path = "sas_test_mapped.bin";
+    std::vector<uint8_t> contents(3 * 4096 + 100);
+    for (size_t i = 0; i < contents.size(); i++) {
+        contents[i] = static_cast<uint8_t>(i * 7);
+    }
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+    auto fileContents = [&] {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+
+    SECTION("Mapping") {
+        // Offsets need not be page aligned
+        const SASSegmentData data = SASSegmentData::mapFile(path, SASSegmentData::MapMode::ReadOnly, 100, 4096);
+        REQUIRE(data.size() == 4096);
+        REQUIRE(std::memcmp(data.data(), contents.data() + 100, 4096) == 0);
+        REQUIRE(SASSegmentData::mapFile(path).size() == contents.size());
+        REQUIRE(SASSegmentData::mapFile(path, SASSegmentData::MapMode::Private, 4096).size() == contents.size() - 4096);
+
+        const SASSegmentData view = data.slice(10, 20);
+        REQUIRE(view.size() == 20);
+        REQUIRE(view.data() == data.data() + 10);
+        REQUIRE(view.isMapped() == data.isMapped());
+
+        REQUIRE_THROWS(SASSegmentData::mapFile("does_not_exist.bin"));
+        REQUIRE_THROWS(SASSegmentData::mapFile(path, SASSegmentData::MapMode::Private, contents.size() + 1));
+        REQUIRE_THROWS(SASSegmentData::mapFile(path, SASSegmentData::MapMode::Private, 100, contents.size()));
+        REQUIRE_THROWS(data.slice(4000, 100));
+    }
+
+    SECTION("Copy-on-write") {
+        for (const auto mode : {SASSegmentData::MapMode::ReadOnly, SASSegmentData::MapMode::Private}) {
+            SASSegmentData data = SASSegmentData::mapFile(path, mode);
+            const bool mapped = data.isMapped();
+            data.mutableData()[5000] = 0xAA;
+            REQUIRE(data[5000] == 0xAA);
+            REQUIRE(data[5001] == contents[5001]);
+            // Read-only mappings are copied to the heap upon the first write, private mappings are written in place
+            REQUIRE(data.isMapped() == (mapped && mode == SASSegmentData::MapMode::Private));
+            REQUIRE(fileContents() == contents);
+        }
+    }
+
+    SECTION("Address space") {
+        SAS sas;
+        sas.getInitSas().insertFile(0x10000, path, SASSegmentData::MapMode::ReadOnly);
+        sas.getInitSas().insertFile(0x20000, path, SASSegmentData::MapMode::Private, 4096, 8);
+        REQUIRE_THROWS(SparseAddressSpace<uint16_t>().insertFile(0xF000, path));
+        sas.reset();
+        REQUIRE(sas.segments().size() == 2);
+        REQUIRE(sas.readByte(0x10000 + 5000) == contents[5000]);
+        REQUIRE(sas.readValue<uint32_t>(0x20004) == sas.getInitSas().readValue<uint32_t>(0x20004));
+        REQUIRE(sas.contains(0x20007) != nullptr);
+        REQUIRE(sas.contains(0x20008) == nullptr);
+
+        // The segment is shared with the initialization SAS until written
+        REQUIRE(sas.contains(0x10000)->data.data() == sas.getInitSas().contains(0x10000)->data.data());
+        sas.writeByte(0x10000, 0xAA);
+        REQUIRE(sas.readByte(0x10000) == 0xAA);
+        REQUIRE(sas.getInitSas().readByte(0x10000) == contents[0]);
+        sas.reset();
+        REQUIRE(sas.readByte(0x10000) == contents[0]);
+        REQUIRE(fileContents() == contents);
+    }
+    std::remove(path.c_str());
+}
+
 TEST_CASE("Fuzz test") {
     // Fuzz-writes a large array, writing segments of the array in a random manner. Then, the sparse address space is
     // sequentially read through to very that the array was written as expected. This is performed with SASs of